@@ -0,0 +1,63 @@
+#ifndef SHAREDPTR_BENCH_H
+#define SHAREDPTR_BENCH_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+// Minimal benchmark harness: a body performs `ops` operations per call;
+// after a few warmup calls every repetition is timed separately and the
+// per-operation times are summarized by their median and 99th percentile.
+
+struct bench_result {
+    double median_ns = 0;
+    double p99_ns = 0;
+};
+
+template <typename T>
+inline void do_not_optimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+template <typename Body>
+bench_result measure(size_t ops, Body&& body, int warmup = 5,
+                     int repetitions = 101) {
+    for (int i = 0; i < warmup; ++i) {
+        body();
+    }
+    std::vector<double> samples;
+    samples.reserve(repetitions);
+    for (int i = 0; i < repetitions; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        auto finish = std::chrono::steady_clock::now();
+        samples.push_back(
+            std::chrono::duration<double, std::nano>(finish - start).count() /
+            static_cast<double>(ops));
+    }
+    std::sort(samples.begin(), samples.end());
+    bench_result result;
+    result.median_ns = samples[samples.size() / 2];
+    result.p99_ns = samples[(samples.size() * 99) / 100];
+    return result;
+}
+
+inline void print_header(const char* first, const char* second) {
+    std::printf("%-28s %10s %10s %10s %10s %8s\n", "scenario", first, "p99",
+                second, "p99", "ratio");
+}
+
+inline void print_row(const char* name, bench_result first,
+                      bench_result second) {
+    std::printf("%-28s %10.2f %10.2f %10.2f %10.2f %8.2f\n", name,
+                first.median_ns, first.p99_ns, second.median_ns,
+                second.p99_ns, first.median_ns / second.median_ns);
+}
+
+inline void print_row(const char* name, bench_result first) {
+    std::printf("%-28s %10.2f %10.2f %10s %10s %8s\n", name, first.median_ns,
+                first.p99_ns, "-", "-", "-");
+}
+
+#endif  //SHAREDPTR_BENCH_H
@@ -0,0 +1,137 @@
+// Scaling of SharedPtr copy construction and destruction under contention.
+//
+// Every thread repeatedly copies and drops either one handle shared by all
+// threads or a handle to its own object. The sweep covers thread counts,
+// the fraction of operations on the shared handle, and two placements of
+// the private control blocks: adjacent (packed next to each other, so the
+// threads' counters share cache lines) and padded (one cache line each),
+// which isolates false sharing from true sharing. Private objects are
+// created by the thread using them, which makes it their owner under the
+// biased policy.
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include "../src/biased_counting.h"
+#include "../src/smart_pointers.h"
+#include "bench.h"
+
+// NOLINTBEGIN
+
+constexpr size_t cache_line = 64;
+
+// bump allocator handing out consecutive chunks, optionally one cache line
+// apart; control blocks allocated through it never get freed individually
+struct arena {
+    alignas(cache_line) char storage[1 << 16];
+    std::atomic<size_t> used = 0;
+    size_t stride = 0;
+
+    void* allocate(size_t size) {
+        size_t step = stride == 0 ? (size + 15) / 16 * 16 : stride;
+        return storage + used.fetch_add(step);
+    }
+};
+
+arena* current_arena = nullptr;
+
+template <typename T>
+struct arena_allocator {
+    using value_type = T;
+
+    arena_allocator() = default;
+
+    template <typename U>
+    arena_allocator(const arena_allocator<U>&) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(current_arena->allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T*, size_t) {}
+};
+
+template <typename Policy>
+double run(size_t threads, int shared_percent, size_t stride,
+           size_t ops_per_thread) {
+    arena blocks;
+    blocks.stride = stride;
+    current_arena = &blocks;
+    auto shared = makeShared<int, Policy>(0);
+
+    std::atomic<size_t> ready = 0;
+    std::atomic<bool> go = false;
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&]() {
+            const auto mine =
+                allocateShared<int, Policy>(arena_allocator<int>(), 0);
+            ++ready;
+            while (!go.load()) {
+                std::this_thread::yield();
+            }
+            for (size_t i = 0; i < ops_per_thread; ++i) {
+                bool use_shared =
+                    static_cast<int>(i % 100) < shared_percent;
+                SharedPtr<int, Policy> copy = use_shared ? shared : mine;
+                do_not_optimize(copy);
+            }
+        });
+    }
+    while (ready.load() != threads) {
+        std::this_thread::yield();
+    }
+    auto start = std::chrono::steady_clock::now();
+    go.store(true);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    auto finish = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(finish - start).count();
+    return static_cast<double>(threads * ops_per_thread) / seconds / 1e6;
+}
+
+template <typename Policy>
+void sweep(const char* policy_name, size_t max_threads,
+           size_t ops_per_thread) {
+    const int shared_percents[] = {0, 10, 50, 100};
+    std::vector<size_t> thread_counts;
+    for (size_t threads = 1; threads < max_threads; threads *= 2) {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(max_threads);
+    for (size_t threads : thread_counts) {
+        for (int shared_percent : shared_percents) {
+            for (size_t stride : {size_t(0), cache_line}) {
+                double total = run<Policy>(threads, shared_percent, stride,
+                                           ops_per_thread);
+                std::printf("%-16s %8zu %8d%% %10s %12.1f %12.1f\n",
+                            policy_name, threads, shared_percent,
+                            stride == 0 ? "adjacent" : "padded", total,
+                            total / static_cast<double>(threads));
+            }
+        }
+    }
+}
+
+// usage: bench_contention [max threads]
+int main(int argc, char** argv) {
+    size_t max_threads = argc > 1 ? std::strtoul(argv[1], nullptr, 10)
+                                  : std::thread::hardware_concurrency();
+    if (max_threads == 0) {
+        max_threads = 4;
+    }
+    const size_t ops_per_thread = 2'000'000;
+    std::printf("copy + destroy, %zu operations per thread\n",
+                ops_per_thread);
+    std::printf("%-16s %8s %9s %10s %12s %12s\n", "policy", "threads",
+                "shared", "private", "Mops/s", "Mops/s/thr");
+    sweep<multi_threaded>("multi_threaded", max_threads, ops_per_thread);
+    sweep<biased>("biased", max_threads, ops_per_thread);
+}
+
+// NOLINTEND
@@ -0,0 +1,120 @@
+// Compares the footprint of control blocks with packed 32/32 counters
+// against the previous layout with two separate size_t counters.
+//
+// For every layout the benchmark allocates a few million blocks through the
+// same allocator path SharedPtr uses, visits them in random order and does
+// one increment/decrement pair per block, so the timing is dominated by
+// cache misses on the counters. Run it under `perf stat -e cache-misses` to
+// see the miss counts next to the timings.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "../src/smart_pointers.h"
+
+// NOLINTBEGIN
+
+// the control block layout before the counters were packed
+struct split_block {
+    split_block(size_t shared, size_t weak, int* ptr)
+        : _shared_counter(shared), _weak_counter(weak), _pointer(ptr) {}
+
+    std::atomic<size_t> _shared_counter = 0;
+    std::atomic<size_t> _weak_counter = 0;
+    int* _pointer;
+    std::default_delete<int> _deleter;
+    std::allocator<int> _allocator;
+
+    virtual void destroy() {}
+    virtual void deallocate() {}
+    virtual ~split_block() = default;
+};
+
+using packed_block = regular_block<int>;
+
+size_t heap_bytes = 0;
+
+template <typename T>
+struct counting_allocator {
+    using value_type = T;
+
+    counting_allocator() = default;
+
+    template <typename U>
+    counting_allocator(const counting_allocator<U>&) {}
+
+    T* allocate(size_t n) {
+        heap_bytes += n * sizeof(T);
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, size_t n) {
+        std::allocator<T>().deallocate(p, n);
+    }
+};
+
+// plain single_threaded updates, so locked instructions do not hide the
+// memory latency which the layouts differ in
+void touch(split_block* block) {
+    size_t value = block->_shared_counter.load(std::memory_order_relaxed);
+    block->_shared_counter.store(value + 1, std::memory_order_relaxed);
+    value = block->_shared_counter.load(std::memory_order_relaxed);
+    block->_shared_counter.store(value - 1, std::memory_order_relaxed);
+}
+
+void touch(packed_block* block) {
+    single_threaded::increment(block, packed_counters::shared_one);
+    single_threaded::decrement(block, packed_counters::shared_one);
+}
+
+template <typename Block>
+void run(const char* name, size_t count, int rounds) {
+    counting_allocator<Block> alloc;
+    std::vector<int> objects(count);
+    std::vector<Block*> blocks(count);
+    heap_bytes = 0;
+    for (size_t i = 0; i < count; ++i) {
+        blocks[i] = alloc.allocate(1);
+        new (blocks[i]) Block(1, 1, &objects[i]);
+    }
+    std::shuffle(blocks.begin(), blocks.end(), std::mt19937_64(42));
+
+    double best = 1e100;
+    for (int round = 0; round < rounds; ++round) {
+        auto start = std::chrono::steady_clock::now();
+        for (Block* block : blocks) {
+            touch(block);
+        }
+        auto finish = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(finish - start)
+                        .count() /
+                    static_cast<double>(count);
+        best = std::min(best, ns);
+    }
+
+    std::printf("%-8s %10zu %8zu %12.1f %10.2f\n", name, count,
+                sizeof(Block), static_cast<double>(heap_bytes) / (1 << 20),
+                best);
+
+    for (Block* block : blocks) {
+        block->~Block();
+        alloc.deallocate(block, 1);
+    }
+}
+
+int main() {
+    const int rounds = 5;
+    std::printf("best of %d rounds\n", rounds);
+    std::printf("%-8s %10s %8s %12s %10s\n", "layout", "blocks", "sizeof",
+                "heap MiB", "ns/block");
+    for (size_t count = size_t(1) << 14; count <= (size_t(1) << 22);
+         count <<= 2) {
+        run<split_block>("split", count, rounds);
+        run<packed_block>("packed", count, rounds);
+    }
+}
+
+// NOLINTEND
@@ -0,0 +1,44 @@
+// Cost of creating an I/O buffer and filling it with received data: with
+// makeShared the buffer is zeroed first, with makeSharedForOverwrite the
+// only pass over the memory is the copy of the payload.
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "../src/smart_pointers.h"
+#include "bench.h"
+
+// NOLINTBEGIN
+
+template <typename Make>
+bench_result receive(size_t size, Make make) {
+    std::vector<unsigned char> payload(size, 0x5a);
+    const size_t buffers = 64;
+    return measure(buffers, [&]() {
+        for (size_t i = 0; i < buffers; ++i) {
+            SharedPtr<unsigned char[]> buffer = make(size);
+            std::memcpy(buffer.get(), payload.data(), size);
+            do_not_optimize(buffer);
+        }
+    });
+}
+
+int main() {
+    std::printf("ns per buffer: allocate, fill with payload, release\n");
+    print_header("zeroed", "overwrite");
+    for (size_t size : {size_t(4) << 10, size_t(64) << 10, size_t(1) << 20,
+                        size_t(8) << 20}) {
+        bench_result zeroed = receive(size, [](size_t n) {
+            return makeShared<unsigned char[]>(n);
+        });
+        bench_result overwrite = receive(size, [](size_t n) {
+            return makeSharedForOverwrite<unsigned char[]>(n);
+        });
+        char name[32];
+        std::snprintf(name, sizeof(name), "%zu KiB", size >> 10);
+        print_row(name, zeroed, overwrite);
+    }
+}
+
+// NOLINTEND
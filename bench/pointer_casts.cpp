@@ -0,0 +1,61 @@
+// Throughput of SharedPtr conversions along a polymorphic hierarchy: the
+// implicit upcast, staticPointerCast and dynamicPointerCast downcasts.
+
+#include <vector>
+
+#include "../src/smart_pointers.h"
+#include "bench.h"
+
+// NOLINTBEGIN
+
+struct Handler {
+    virtual ~Handler() = default;
+    virtual int handle() {
+        return 0;
+    }
+};
+
+struct Logging : Handler {};
+
+struct Routing : Logging {
+    int handle() override {
+        return 1;
+    }
+};
+
+int main() {
+    const size_t count = 1 << 16;
+    std::vector<SharedPtr<Routing>> derived;
+    std::vector<SharedPtr<Handler>> base;
+    for (size_t i = 0; i < count; ++i) {
+        derived.push_back(makeShared<Routing>());
+        base.push_back(derived.back());
+    }
+
+    std::printf("ns per conversion of %zu pointers\n", count);
+    std::printf("%-28s %10s %10s\n", "conversion", "median", "p99");
+    auto print = [](const char* name, bench_result result) {
+        std::printf("%-28s %10.2f %10.2f\n", name, result.median_ns,
+                    result.p99_ns);
+    };
+    print("implicit upcast", measure(count, [&]() {
+              for (const auto& ptr : derived) {
+                  SharedPtr<Handler> handler = ptr;
+                  do_not_optimize(handler);
+              }
+          }));
+    print("staticPointerCast", measure(count, [&]() {
+              for (const auto& ptr : base) {
+                  auto routing = staticPointerCast<Routing>(ptr);
+                  do_not_optimize(routing);
+              }
+          }));
+    print("dynamicPointerCast", measure(count, [&]() {
+              for (const auto& ptr : base) {
+                  auto routing = dynamicPointerCast<Routing>(ptr);
+                  do_not_optimize(routing);
+              }
+          }));
+}
+
+// NOLINTEND
@@ -0,0 +1,161 @@
+// Lookups in a read-mostly table of shared slots with many reader threads.
+//
+// Readers repeatedly pick an entry and read a field of it while one writer
+// keeps replacing entries. AtomicSharedPtr readers copy the stored SharedPtr,
+// so every lookup increments and decrements the entry's counter, which all
+// readers of that entry share; HazardSlot readers only publish a hazard, and
+// EpochSlot and RcuPtr readers only announce their epoch.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "../src/atomic_shared_ptr.h"
+#include "../src/epoch_reclamation.h"
+#include "../src/hazard_pointers.h"
+#include "../src/rcu_ptr.h"
+#include "../src/smart_pointers.h"
+#include "bench.h"
+
+// NOLINTBEGIN
+
+constexpr size_t entries = 64;
+
+struct Entry {
+    explicit Entry(size_t key) : key(key) {}
+
+    size_t key;
+};
+
+struct atomic_table {
+    static constexpr const char* name = "AtomicSharedPtr";
+
+    AtomicSharedPtr<Entry> slots[entries];
+
+    size_t lookup(size_t index) {
+        return slots[index].load()->key;
+    }
+
+    void store(size_t index, size_t key) {
+        slots[index].store(makeShared<Entry>(key));
+    }
+};
+
+struct hazard_table {
+    static constexpr const char* name = "HazardSlot";
+
+    HazardSlot<Entry> slots[entries];
+
+    size_t lookup(size_t index) {
+        return slots[index].read()->key;
+    }
+
+    void store(size_t index, size_t key) {
+        slots[index].store(makeShared<Entry>(key));
+    }
+};
+
+struct epoch_table {
+    static constexpr const char* name = "EpochSlot";
+
+    EpochSlot<Entry> slots[entries];
+
+    size_t lookup(size_t index) {
+        EpochGuard guard;
+        return slots[index].get()->key;
+    }
+
+    void store(size_t index, size_t key) {
+        using policy = epoch_release<multi_threaded>;
+        slots[index].store(makeShared<Entry, policy>(key));
+    }
+};
+
+struct rcu_table {
+    static constexpr const char* name = "RcuPtr";
+
+    RcuPtr<Entry> slots[entries];
+
+    size_t lookup(size_t index) {
+        return slots[index].read()->key;
+    }
+
+    void store(size_t index, size_t key) {
+        slots[index].publish(makeShared<Entry>(key));
+    }
+};
+
+// returns millions of lookups per second over all readers
+template <typename Table>
+double run(size_t readers, size_t lookups_per_reader) {
+    Table table;
+    for (size_t i = 0; i < entries; ++i) {
+        table.store(i, i);
+    }
+    std::atomic<size_t> ready = 0;
+    std::atomic<bool> go = false;
+    std::atomic<size_t> finished = 0;
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < readers; ++t) {
+        threads.emplace_back([&, t]() {
+            ++ready;
+            while (!go.load()) {
+                std::this_thread::yield();
+            }
+            size_t sum = 0;
+            for (size_t i = 0; i < lookups_per_reader; ++i) {
+                sum += table.lookup((i + t) % entries);
+            }
+            do_not_optimize(sum);
+            ++finished;
+        });
+    }
+    std::thread writer([&]() {
+        size_t next = 0;
+        while (finished.load() != readers) {
+            table.store(next % entries, next % entries);
+            ++next;
+            std::this_thread::sleep_for(std::chrono::microseconds(10));
+        }
+    });
+    while (ready.load() != readers) {
+        std::this_thread::yield();
+    }
+    auto start = std::chrono::steady_clock::now();
+    go.store(true);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    auto finish = std::chrono::steady_clock::now();
+    writer.join();
+    double seconds = std::chrono::duration<double>(finish - start).count();
+    return static_cast<double>(readers * lookups_per_reader) / seconds / 1e6;
+}
+
+template <typename Table>
+void sweep(size_t max_readers, size_t lookups_per_reader) {
+    for (size_t readers = 1; readers <= max_readers; readers *= 4) {
+        double total = run<Table>(readers, lookups_per_reader);
+        std::printf("%-16s %8zu %12.1f %12.2f\n", Table::name, readers, total,
+                    total / static_cast<double>(readers));
+    }
+}
+
+// usage: bench_read_mostly [max readers]
+int main(int argc, char** argv) {
+    size_t max_readers = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 256;
+    const size_t lookups_per_reader = 200'000;
+    std::printf("table lookups, %zu per reader, one writer\n",
+                lookups_per_reader);
+    std::printf("%-16s %8s %12s %12s\n", "slot", "readers", "Mops/s",
+                "Mops/s/thr");
+    sweep<atomic_table>(max_readers, lookups_per_reader);
+    sweep<hazard_table>(max_readers, lookups_per_reader);
+    sweep<epoch_table>(max_readers, lookups_per_reader);
+    sweep<rcu_table>(max_readers, lookups_per_reader);
+}
+
+// NOLINTEND
@@ -0,0 +1,241 @@
+// Runs identical scenarios against SharedPtr/WeakPtr and
+// std::shared_ptr/std::weak_ptr and prints median and p99 ns per operation.
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "../src/biased_counting.h"
+#include "../src/compact_shared_ptr.h"
+#include "../src/cycle_collector.h"
+#include "../src/intrusive_ptr.h"
+#include "../src/refcount_buffer.h"
+#include "../src/smart_pointers.h"
+#include "bench.h"
+
+// NOLINTBEGIN
+
+struct ours {
+    static constexpr const char* name = "SharedPtr";
+
+    template <typename T>
+    using shared = SharedPtr<T>;
+
+    template <typename T>
+    using weak = WeakPtr<T>;
+
+    template <typename T, typename... Args>
+    static shared<T> make(Args&&... args) {
+        return makeShared<T>(std::forward<Args>(args)...);
+    }
+};
+
+struct standard {
+    static constexpr const char* name = "std";
+
+    template <typename T>
+    using shared = std::shared_ptr<T>;
+
+    template <typename T>
+    using weak = std::weak_ptr<T>;
+
+    template <typename T, typename... Args>
+    static shared<T> make(Args&&... args) {
+        return std::make_shared<T>(std::forward<Args>(args)...);
+    }
+};
+
+const size_t ops = 10'000;
+
+template <typename Family>
+bench_result copy() {
+    auto source = Family::template make<int>(1);
+    return measure(ops, [&]() {
+        for (size_t i = 0; i < ops; ++i) {
+            typename Family::template shared<int> copy = source;
+            do_not_optimize(copy);
+        }
+    });
+}
+
+template <typename Family>
+bench_result move() {
+    auto first = Family::template make<int>(1);
+    typename Family::template shared<int> second;
+    return measure(ops, [&]() {
+        for (size_t i = 0; i < ops; ++i) {
+            second = std::move(first);
+            first = std::move(second);
+            do_not_optimize(first);
+        }
+    });
+}
+
+template <typename Family>
+bench_result make_shared() {
+    return measure(ops, [&]() {
+        for (size_t i = 0; i < ops; ++i) {
+            auto ptr = Family::template make<int>(static_cast<int>(i));
+            do_not_optimize(ptr);
+        }
+    });
+}
+
+template <typename Family>
+bench_result from_raw() {
+    return measure(ops, [&]() {
+        for (size_t i = 0; i < ops; ++i) {
+            typename Family::template shared<int> ptr(
+                new int(static_cast<int>(i)));
+            do_not_optimize(ptr);
+        }
+    });
+}
+
+template <typename Family>
+bench_result reset_raw() {
+    typename Family::template shared<int> ptr(new int(0));
+    return measure(ops, [&]() {
+        for (size_t i = 0; i < ops; ++i) {
+            ptr.reset(new int(static_cast<int>(i)));
+            do_not_optimize(ptr);
+        }
+    });
+}
+
+template <typename Family>
+bench_result lock() {
+    auto source = Family::template make<int>(1);
+    typename Family::template weak<int> observer = source;
+    return measure(ops, [&]() {
+        for (size_t i = 0; i < ops; ++i) {
+            auto locked = observer.lock();
+            do_not_optimize(locked);
+        }
+    });
+}
+
+template <typename Family>
+bench_result lock_expired() {
+    typename Family::template weak<int> observer =
+        Family::template make<int>(1);
+    return measure(ops, [&]() {
+        for (size_t i = 0; i < ops; ++i) {
+            auto locked = observer.lock();
+            do_not_optimize(locked);
+        }
+    });
+}
+
+template <typename Family>
+bench_result teardown() {
+    const size_t count = 1'000;
+    const int repetitions = 101;
+    std::vector<std::vector<typename Family::template shared<int>>> batches(
+        repetitions + 5);
+    for (auto& batch : batches) {
+        for (size_t i = 0; i < count; ++i) {
+            batch.push_back(Family::template make<int>(static_cast<int>(i)));
+        }
+    }
+    size_t next = 0;
+    return measure(
+        count,
+        [&]() {
+            batches[next++].clear();
+        },
+        5, repetitions);
+}
+
+template <typename Policy>
+bench_result copy_with_policy() {
+    auto source = makeShared<int, Policy>(1);
+    return measure(ops, [&]() {
+        for (size_t i = 0; i < ops; ++i) {
+            SharedPtr<int, Policy> copy = source;
+            do_not_optimize(copy);
+        }
+    });
+}
+
+// the same loop inside one RefcountBuffer scope per sample
+bench_result copy_buffered() {
+    auto source = makeShared<int, buffered<multi_threaded>>(1);
+    return measure(ops, [&]() {
+        RefcountBuffer buffer;
+        for (size_t i = 0; i < ops; ++i) {
+            SharedPtr<int, buffered<multi_threaded>> copy = source;
+            do_not_optimize(copy);
+        }
+    });
+}
+
+struct intrusive_int : IntrusiveRefCounted<intrusive_int> {
+    int value = 1;
+};
+
+bench_result copy_intrusive() {
+    auto source = makeIntrusive<intrusive_int>();
+    return measure(ops, [&]() {
+        for (size_t i = 0; i < ops; ++i) {
+            IntrusivePtr<intrusive_int> copy = source;
+            do_not_optimize(copy);
+        }
+    });
+}
+
+// sums the objects behind a container of handles; the handles of the
+// compact container take half the memory
+template <typename Handle, typename Make>
+bench_result walk_handles(Make make) {
+    const size_t count = 1 << 20;
+    std::vector<Handle> handles;
+    handles.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        handles.push_back(make(static_cast<int>(i)));
+    }
+    return measure(
+        count,
+        [&]() {
+            long long sum = 0;
+            for (const Handle& handle : handles) {
+                sum += *handle;
+            }
+            do_not_optimize(sum);
+        },
+        2, 21);
+}
+
+int main() {
+    // libstdc++ falls back to plain counters until the program starts a
+    // thread; start one so that both sides count atomically
+    std::thread([]() {}).join();
+
+    std::printf("ns per operation, %zu operations per sample\n", ops);
+    print_header(ours::name, standard::name);
+    print_row("copy + destroy", copy<ours>(), copy<standard>());
+    print_row("move assign (x2)", move<ours>(), move<standard>());
+    print_row("makeShared + destroy", make_shared<ours>(),
+              make_shared<standard>());
+    print_row("from new T + destroy", from_raw<ours>(), from_raw<standard>());
+    print_row("reset(new T)", reset_raw<ours>(), reset_raw<standard>());
+    print_row("WeakPtr::lock", lock<ours>(), lock<standard>());
+    print_row("WeakPtr::lock (expired)", lock_expired<ours>(),
+              lock_expired<standard>());
+    print_row("teardown of unique ptrs", teardown<ours>(),
+              teardown<standard>());
+    print_row("copy + destroy (single)", copy_with_policy<single_threaded>());
+    print_row("copy + destroy (biased)", copy_with_policy<biased>());
+    print_row("copy + destroy (cycles)", copy_with_policy<cycle_collected>());
+    print_row("copy + destroy (buffered)", copy_buffered());
+    print_row("copy + destroy (intrusive)", copy_intrusive());
+    print_row("walk 1M handles", walk_handles<SharedPtr<int>>([](int value) {
+                  return makeShared<int>(value);
+              }));
+    print_row("walk 1M handles (compact)",
+              walk_handles<CompactSharedPtr<int>>([](int value) {
+                  return makeCompact<int>(value);
+              }));
+}
+
+// NOLINTEND
@@ -0,0 +1,193 @@
+#ifndef SHAREDPTR_ATOMIC_SHARED_PTR_H
+#define SHAREDPTR_ATOMIC_SHARED_PTR_H
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <exception>
+
+#include "smart_pointers.h"
+
+// Lock-free slot holding a SharedPtr<T>, based on split reference counts.
+//
+// The stored SharedPtr lives in an immutable holder. The slot word packs the
+// holder address (low 48 bits) with an external counter of readers which are
+// copying out of it (high 16 bits). A reader announces itself with a single
+// fetch_add, copies the SharedPtr and then returns its loan either to the
+// slot word, if the holder is still installed, or to the holder's internal
+// counter. A writer which swaps the holder out moves the external counter to
+// the internal one, so the holder and the reference to base_block it owns
+// are released only after the last reader has finished copying. An empty
+// slot holds a holder with an empty SharedPtr as well, a fresh one each
+// time, so that readers which took a loan on an empty slot find their way
+// back to it however often the slot is emptied and filled again. Every
+// thread holds at most one loan, so up to max_readers threads may be inside
+// load() at once; like the reference counts, the program terminates rather
+// than letting the reader counter overflow.
+//
+// Holders must have addresses below 2^48, as user space has with 4-level
+// paging; with 5-level paging the kernel hands out higher addresses only to
+// processes which map them explicitly. Debug builds check every holder.
+template <typename T>
+class AtomicSharedPtr {
+    static_assert(sizeof(uintptr_t) == sizeof(uint64_t),
+                  "pointer packing requires a 64-bit address space");
+
+    struct holder {
+        explicit holder(SharedPtr<T>&& value) : _value(std::move(value)) {}
+
+        SharedPtr<T> _value;
+        std::atomic<int64_t> _internal_counter = 0;
+    };
+
+    static constexpr int reader_shift = 48;
+    static constexpr uintptr_t one_reader = uintptr_t(1) << reader_shift;
+    static constexpr uintptr_t pointer_mask = one_reader - 1;
+
+  public:
+    using value_type = SharedPtr<T>;
+
+    static constexpr size_t max_readers =
+        (size_t(1) << (64 - reader_shift)) - 1;
+
+    AtomicSharedPtr() : _word(make_word(SharedPtr<T>())) {}
+
+    AtomicSharedPtr(SharedPtr<T> value)
+        : _word(make_word(std::move(value))) {}
+
+    AtomicSharedPtr(const AtomicSharedPtr&) = delete;
+    AtomicSharedPtr& operator=(const AtomicSharedPtr&) = delete;
+
+    AtomicSharedPtr& operator=(SharedPtr<T> value) {
+        store(std::move(value));
+        return *this;
+    }
+
+    bool is_lock_free() const noexcept {
+        return _word.is_lock_free();
+    }
+
+    SharedPtr<T> load() const {
+        holder* current = acquire();
+        SharedPtr<T> result = current->_value;
+        release(current);
+        return result;
+    }
+
+    operator SharedPtr<T>() const {
+        return load();
+    }
+
+    void store(SharedPtr<T> value) {
+        exchange(std::move(value));
+    }
+
+    SharedPtr<T> exchange(SharedPtr<T> value) {
+        uintptr_t previous = _word.exchange(make_word(std::move(value)),
+                                            std::memory_order_acq_rel);
+        holder* old = to_holder(previous);
+        size_t readers = to_readers(previous);
+        if (readers == 0) {
+            SharedPtr<T> result = std::move(old->_value);
+            delete old;
+            return result;
+        }
+        SharedPtr<T> result = old->_value;
+        retire(old, readers);
+        return result;
+    }
+
+    // compares the stored and the expected values by object and control
+    // block; on failure expected receives the stored value
+    bool compare_exchange_strong(SharedPtr<T>& expected,
+                                 SharedPtr<T> desired) {
+        uintptr_t desired_word = make_word(std::move(desired));
+        while (true) {
+            holder* current = acquire();
+            if (!holds(current, expected)) {
+                expected = current->_value;
+                release(current);
+                delete to_holder(desired_word);
+                return false;
+            }
+            uintptr_t seen = _word.load(std::memory_order_relaxed);
+            while (to_holder(seen) == current) {
+                if (_word.compare_exchange_weak(seen, desired_word,
+                                                std::memory_order_acq_rel,
+                                                std::memory_order_relaxed)) {
+                    // our own loan disappears together with the old word
+                    retire(current, to_readers(seen) - 1);
+                    return true;
+                }
+            }
+            release(current);
+        }
+    }
+
+    bool compare_exchange_weak(SharedPtr<T>& expected,
+                               SharedPtr<T> desired) {
+        return compare_exchange_strong(expected, std::move(desired));
+    }
+
+    ~AtomicSharedPtr() {
+        delete to_holder(_word.load(std::memory_order_relaxed));
+    }
+
+  private:
+    static uintptr_t make_word(SharedPtr<T>&& value) {
+        auto word = reinterpret_cast<uintptr_t>(new holder(std::move(value)));
+        assert((word & ~pointer_mask) == 0);
+        return word;
+    }
+
+    static holder* to_holder(uintptr_t word) noexcept {
+        return reinterpret_cast<holder*>(word & pointer_mask);
+    }
+
+    static size_t to_readers(uintptr_t word) noexcept {
+        return word >> reader_shift;
+    }
+
+    static bool holds(const holder* current, const SharedPtr<T>& value) {
+        return current->_value._ptr == value._ptr &&
+               current->_value._control_block == value._control_block;
+    }
+
+    holder* acquire() const noexcept {
+        uintptr_t seen =
+            _word.fetch_add(one_reader, std::memory_order_acquire);
+        if (to_readers(seen) == max_readers) {
+            std::terminate();
+        }
+        return to_holder(seen);
+    }
+
+    void release(holder* current) const {
+        uintptr_t seen = _word.load(std::memory_order_relaxed);
+        while (to_holder(seen) == current) {
+            if (_word.compare_exchange_weak(seen, seen - one_reader,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+                return;
+            }
+        }
+        // the holder was swapped out, the writer has moved our loan to the
+        // internal counter
+        if (current->_internal_counter.fetch_sub(
+                1, std::memory_order_acq_rel) == 1) {
+            delete current;
+        }
+    }
+
+    static void retire(holder* old, size_t readers) {
+        auto loans = static_cast<int64_t>(readers);
+        if (old->_internal_counter.fetch_add(
+                loans, std::memory_order_acq_rel) + loans == 0) {
+            delete old;
+        }
+    }
+
+    mutable std::atomic<uintptr_t> _word;
+};
+
+#endif  //SHAREDPTR_ATOMIC_SHARED_PTR_H
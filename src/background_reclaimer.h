@@ -0,0 +1,175 @@
+#ifndef SHAREDPTR_BACKGROUND_RECLAIMER_H
+#define SHAREDPTR_BACKGROUND_RECLAIMER_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "smart_pointers.h"
+
+// Queue of expired control blocks whose objects are destroyed away from the
+// thread which dropped the last SharedPtr.
+//
+// Blocks are reclaimed in batches either by a background thread (start() /
+// stop()) or by an explicit drain(). The background thread wakes up once
+// batch_size blocks are pending or after flush_interval. When max_pending
+// blocks are already waiting, an enqueuing thread reclaims one batch itself,
+// which bounds the memory held by the queue.
+class BackgroundReclaimer {
+  public:
+    using expire_function = void (*)(base_block*, uint64_t);
+
+    BackgroundReclaimer() = default;
+
+    BackgroundReclaimer(const BackgroundReclaimer&) = delete;
+    BackgroundReclaimer& operator=(const BackgroundReclaimer&) = delete;
+
+    static BackgroundReclaimer& instance() {
+        static BackgroundReclaimer reclaimer;
+        return reclaimer;
+    }
+
+    void configure(size_t batch_size, size_t max_pending,
+                   std::chrono::milliseconds flush_interval =
+                       std::chrono::milliseconds(10)) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _batch_size = batch_size == 0 ? 1 : batch_size;
+        _max_pending = max_pending < _batch_size ? _batch_size : max_pending;
+        _flush_interval = flush_interval;
+    }
+
+    void start() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_worker.joinable()) {
+            return;
+        }
+        _stopping = false;
+        _worker = std::thread([this]() {
+            run();
+        });
+    }
+
+    // reclaims everything which is still pending and joins the thread
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _wakeup.notify_all();
+        if (_worker.joinable()) {
+            _worker.join();
+        }
+        drain();
+    }
+
+    // reclaims all pending blocks on the calling thread, including those
+    // which are expired while draining; returns their number
+    size_t drain() {
+        size_t reclaimed = 0;
+        while (size_t count = reclaim_batch(static_cast<size_t>(-1))) {
+            reclaimed += count;
+        }
+        return reclaimed;
+    }
+
+    size_t pending() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _pending.size();
+    }
+
+    void enqueue(expire_function expire, base_block* block, uint64_t left) {
+        size_t batch_size = 0;
+        bool queued = false;
+        bool wake = false;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            batch_size = _batch_size;
+            if (_pending.size() < _max_pending) {
+                _pending.push_back({expire, block, left});
+                queued = true;
+                wake = _pending.size() == batch_size;
+            }
+        }
+        if (wake) {
+            _wakeup.notify_one();
+        }
+        if (!queued) {
+            // the queue is full: help out instead of growing it further
+            reclaim_batch(batch_size);
+            expire(block, left);
+        }
+    }
+
+    ~BackgroundReclaimer() {
+        stop();
+    }
+
+  private:
+    struct entry {
+        expire_function _expire;
+        base_block* _block;
+        uint64_t _left;
+    };
+
+    size_t reclaim_batch(size_t limit) {
+        std::vector<entry> batch;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            size_t count = std::min(limit, _pending.size());
+            batch.assign(_pending.begin(), _pending.begin() + count);
+            _pending.erase(_pending.begin(), _pending.begin() + count);
+        }
+        for (const entry& item : batch) {
+            item._expire(item._block, item._left);
+        }
+        return batch.size();
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true) {
+            _wakeup.wait_for(lock, _flush_interval, [this]() {
+                return _stopping || _pending.size() >= _batch_size;
+            });
+            if (_stopping) {
+                return;
+            }
+            size_t batch_size = _batch_size;
+            lock.unlock();
+            reclaim_batch(batch_size);
+            lock.lock();
+        }
+    }
+
+    mutable std::mutex _mutex;
+    std::condition_variable _wakeup;
+    std::deque<entry> _pending;
+    std::thread _worker;
+    size_t _batch_size = 64;
+    size_t _max_pending = 1 << 16;
+    std::chrono::milliseconds _flush_interval = std::chrono::milliseconds(10);
+    bool _stopping = false;
+};
+
+// Hands expired blocks to BackgroundReclaimer::instance(), so the thread
+// dropping the last SharedPtr only pays for an enqueue; Base::expire runs
+// later on the reclaiming thread.
+template <typename Base>
+struct background_release : Base {
+    static_assert(!Base::thread_confined,
+                  "blocks of a thread_confined policy cannot be reclaimed by "
+                  "another thread");
+
+    static constexpr bool recyclable = false;
+
+    static void expire(base_block* block, uint64_t left) {
+        BackgroundReclaimer::instance().enqueue(&Base::expire, block, left);
+    }
+};
+
+#endif  //SHAREDPTR_BACKGROUND_RECLAIMER_H
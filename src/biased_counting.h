@@ -0,0 +1,309 @@
+#ifndef SHAREDPTR_BIASED_COUNTING_H
+#define SHAREDPTR_BIASED_COUNTING_H
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+
+#include "smart_pointers.h"
+
+// Biased reference counting for objects which mostly stay on the thread that
+// created them.
+//
+// A block remembers its owner thread. Strong references taken and dropped by
+// the owner are counted in a plain biased counter; every other thread uses
+// an atomic shared counter, which may go negative when a reference counted
+// by the owner is dropped elsewhere. The object lives while their sum is
+// positive. The counters are merged, and the shared counter alone decides
+// from then on, when the biased counter drops to zero, when the owner takes
+// over a block which another thread has queued to it after making the shared
+// counter negative, or when the owner thread exits. The owner takes over
+// queued blocks whenever it drops a reference; biased::collect() does so
+// explicitly.
+//
+// While the block is alive its strong half of the counters word stays at 1,
+// so WeakPtr and the release path keep working on the word unchanged; weak
+// references are counted there as in multi_threaded.
+
+struct biased_block;
+
+// One per thread which has created biased blocks. Records are never freed,
+// so a block can name its owner even after the owner has exited.
+class biased_owner {
+  public:
+    // returns nullptr while thread-local objects of the thread are destroyed
+    static biased_owner* local() noexcept {
+        thread_local biased_owner* owner = nullptr;
+        thread_local bool finished = false;
+        if (owner == nullptr && !finished) {
+            owner = enroll();
+            thread_local exit_guard guard(&owner, &finished);
+        }
+        return owner;
+    }
+
+    // merges the blocks which other threads have queued to this owner
+    void collect();
+
+    // returns false once the owner has exited; the caller merges the block
+    bool hand_over(biased_block* block) noexcept;
+
+  private:
+    class exit_guard {
+      public:
+        exit_guard(biased_owner** owner, bool* finished)
+            : _owner(owner), _finished(finished) {}
+
+        exit_guard(const exit_guard&) = delete;
+        exit_guard& operator=(const exit_guard&) = delete;
+
+        ~exit_guard() {
+            biased_owner* owner = *_owner;
+            *_owner = nullptr;
+            *_finished = true;
+            owner->close();
+        }
+
+      private:
+        biased_owner** _owner;
+        bool* _finished;
+    };
+
+    static biased_owner* enroll() {
+        static std::atomic<biased_owner*> records = nullptr;
+        auto* record = new biased_owner();
+        record->_next_record = records.load(std::memory_order_relaxed);
+        while (!records.compare_exchange_weak(record->_next_record, record,
+                                              std::memory_order_release,
+                                              std::memory_order_relaxed)) {
+        }
+        return record;
+    }
+
+    // marks the queue of an exited owner
+    static biased_block* closed() noexcept {
+        static char sentinel;
+        return reinterpret_cast<biased_block*>(&sentinel);
+    }
+
+    void close();
+
+    static void settle_all(biased_block* list);
+
+    std::atomic<biased_block*> _queue = nullptr;
+    biased_owner* _next_record = nullptr;
+};
+
+struct biased_block : base_block {
+    // the shared counter holds the count shifted left by two and the flags
+    static constexpr int64_t merged = 1;
+    static constexpr int64_t queued = 2;
+    static constexpr int64_t one = 4;
+
+    biased_block(size_t shared, size_t weak,
+                 const block_operations* operations)
+        : base_block(shared == 0 ? 0 : 1, weak, operations),
+          _owner(biased_owner::local()) {
+        if (_owner == nullptr) {
+            _shared.store(static_cast<int64_t>(shared) * one | merged,
+                          std::memory_order_relaxed);
+        } else {
+            _biased.store(static_cast<uint32_t>(shared),
+                          std::memory_order_relaxed);
+        }
+    }
+
+    static int64_t count(int64_t word) noexcept {
+        return word >> 2;
+    }
+
+    // merged, not pinned by a pending hand-over, and nothing left
+    static bool dead(int64_t word) noexcept {
+        return (word & (merged | queued)) == merged && count(word) == 0;
+    }
+
+    bool owned() const noexcept {
+        return _owner != nullptr && _owner == biased_owner::local() &&
+               (_shared.load(std::memory_order_relaxed) & merged) == 0;
+    }
+
+    // adds the biased counter to the shared one and clears the queued flag;
+    // called by the owner, or by anyone once the owner has exited
+    bool settle() noexcept {
+        int64_t word = _shared.load(std::memory_order_relaxed);
+        int64_t delta = -queued;
+        if ((word & merged) == 0) {
+            delta += static_cast<int64_t>(
+                         _biased.load(std::memory_order_relaxed)) *
+                         one +
+                     merged;
+            _biased.store(0, std::memory_order_relaxed);
+        }
+        return dead(_shared.fetch_add(delta, std::memory_order_acq_rel) +
+                    delta);
+    }
+
+    biased_owner* const _owner;
+    // touched by the owner thread only, atomic merely for use_count()
+    std::atomic<uint32_t> _biased = 0;
+    std::atomic<int64_t> _shared = 0;
+    biased_block* _next_queued = nullptr;
+};
+
+struct biased : basic_policy<biased> {
+    using block_header = biased_block;
+
+    static void increment(base_block* block, uint64_t unit) noexcept {
+        if (unit == packed_counters::weak_one) {
+            multi_threaded::increment(block, unit);
+            return;
+        }
+        auto* self = static_cast<biased_block*>(block);
+        if (self->owned()) {
+            uint32_t value = self->_biased.load(std::memory_order_relaxed);
+            if (value == packed_counters::half_mask) {
+                std::terminate();
+            }
+            self->_biased.store(value + 1, std::memory_order_relaxed);
+            return;
+        }
+        int64_t word = self->_shared.fetch_add(biased_block::one,
+                                               std::memory_order_relaxed);
+        if (biased_block::count(word) >= INT32_MAX) {
+            std::terminate();
+        }
+    }
+
+    // returns a value with a non-zero strong half while the object lives
+    static uint64_t decrement(base_block* block, uint64_t unit) noexcept {
+        if (unit == packed_counters::weak_one) {
+            return multi_threaded::decrement(block, unit);
+        }
+        auto* self = static_cast<biased_block*>(block);
+        if (self->owned()) {
+            // queued blocks are settled here, so a thread which keeps
+            // releasing references never holds on to dead objects for long
+            biased_owner* owner = self->_owner;
+            uint32_t value =
+                self->_biased.load(std::memory_order_relaxed) - 1;
+            self->_biased.store(value, std::memory_order_relaxed);
+            if (value != 0) {
+                owner->collect();
+                return packed_counters::shared_one;
+            }
+            // once merged the block may die on another thread at any time
+            bool gone = biased_block::dead(
+                self->_shared.fetch_add(biased_block::merged,
+                                        std::memory_order_acq_rel) +
+                biased_block::merged);
+            owner->collect();
+            return gone ? kill(self) : packed_counters::shared_one;
+        }
+        int64_t word = self->_shared.load(std::memory_order_relaxed);
+        int64_t next = 0;
+        do {
+            next = word - biased_block::one;
+            // a negative count pins the block until the owner merges it
+            if ((word & biased_block::merged) == 0 &&
+                biased_block::count(next) < 0) {
+                next |= biased_block::queued;
+            }
+        } while (!self->_shared.compare_exchange_weak(
+            word, next, std::memory_order_acq_rel, std::memory_order_relaxed));
+        if ((next & ~word & biased_block::queued) != 0) {
+            if (self->_owner->hand_over(self) || !self->settle()) {
+                return packed_counters::shared_one;
+            }
+            return kill(self);
+        }
+        return biased_block::dead(next) ? kill(self)
+                                        : packed_counters::shared_one;
+    }
+
+    static bool increment_if_nonzero(base_block* block,
+                                     uint64_t unit) noexcept {
+        if (unit == packed_counters::weak_one) {
+            return multi_threaded::increment_if_nonzero(block, unit);
+        }
+        auto* self = static_cast<biased_block*>(block);
+        if (self->owned()) {
+            // the owner's own references keep the block unmerged
+            increment(block, unit);
+            return true;
+        }
+        int64_t word = self->_shared.load(std::memory_order_relaxed);
+        do {
+            if (biased_block::dead(word)) {
+                return false;
+            }
+        } while (!self->_shared.compare_exchange_weak(
+            word, word + biased_block::one, std::memory_order_acq_rel,
+            std::memory_order_relaxed));
+        return true;
+    }
+
+    static size_t use_count(const base_block* block) noexcept {
+        if (block->use_count() == 0) {
+            return 0;
+        }
+        auto* self = static_cast<const biased_block*>(block);
+        int64_t total =
+            self->_biased.load(std::memory_order_relaxed) +
+            biased_block::count(self->_shared.load(std::memory_order_relaxed));
+        return total > 0 ? static_cast<size_t>(total) : 1;
+    }
+
+    // the two counters cannot be read at once, so blocks are never recycled
+    static bool unique(const base_block* /*unused*/) noexcept {
+        return false;
+    }
+
+    // merges whatever other threads have queued to the calling thread
+    static void collect() {
+        if (biased_owner* owner = biased_owner::local()) {
+            owner->collect();
+        }
+    }
+
+    // drops the strong half of the counters word, which the caller expires
+    static uint64_t kill(biased_block* block) noexcept {
+        return multi_threaded::decrement(block, packed_counters::shared_one);
+    }
+};
+
+// seeing closed() also makes the owner's last biased counts visible
+inline bool biased_owner::hand_over(biased_block* block) noexcept {
+    biased_block* head = _queue.load(std::memory_order_acquire);
+    do {
+        if (head == closed()) {
+            return false;
+        }
+        block->_next_queued = head;
+    } while (!_queue.compare_exchange_weak(head, block,
+                                           std::memory_order_release,
+                                           std::memory_order_acquire));
+    return true;
+}
+
+inline void biased_owner::settle_all(biased_block* list) {
+    while (list != nullptr) {
+        biased_block* next = list->_next_queued;
+        if (list->settle()) {
+            biased::expire(list, biased::kill(list));
+        }
+        list = next;
+    }
+}
+
+inline void biased_owner::collect() {
+    if (_queue.load(std::memory_order_relaxed) == nullptr) {
+        return;
+    }
+    settle_all(_queue.exchange(nullptr, std::memory_order_acquire));
+}
+
+inline void biased_owner::close() {
+    settle_all(_queue.exchange(closed(), std::memory_order_acq_rel));
+}
+
+#endif  //SHAREDPTR_BIASED_COUNTING_H
@@ -0,0 +1,162 @@
+#ifndef SHAREDPTR_COMPACT_SHARED_PTR_H
+#define SHAREDPTR_COMPACT_SHARED_PTR_H
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include "smart_pointers.h"
+
+// Single-word handle to an object created by makeCompact / allocateCompact.
+//
+// The object lives inside a shared_block whose exact type follows from the
+// template arguments, so only the block pointer is stored and the object
+// address is a constant offset from it. The handle shares the block with
+// SharedPtr and WeakPtr: share() yields a SharedPtr to the same object.
+// Conversions to handles of base classes go through SharedPtr, since the
+// offset is only known for T itself; for the same reason T must not be one
+// of the large types makeShared places out of line. Arrays live in blocks of
+// their own type and need a SharedPtr too.
+template <typename T, typename Policy = multi_threaded,
+          typename Allocator = typename default_block_allocator<T>::type>
+class CompactSharedPtr {
+    static_assert(!std::is_array_v<T>, "arrays need a SharedPtr");
+
+    using block_type =
+        shared_block<T, Allocator, typename Policy::block_header>;
+
+  public:
+    using type = T;
+    using pointer = T*;
+    using const_pointer = const T*;
+    using reference = T&;
+    using const_reference = const T&;
+    using block = base_block;
+    using block_pointer = base_block*;
+    using threading_policy = Policy;
+
+    template <typename U, typename P, typename A, typename... Args>
+    friend CompactSharedPtr<U, P, A> allocateCompact(const A& allocator,
+                                                     Args&&... args);
+
+    CompactSharedPtr() = default;
+
+    CompactSharedPtr(const CompactSharedPtr& another)
+        : _control_block(another._control_block) {
+        if (_control_block != nullptr) {
+            Policy::increment(_control_block, packed_counters::shared_one);
+        }
+    }
+
+    CompactSharedPtr(CompactSharedPtr&& another) noexcept
+        : _control_block(another._control_block) {
+        another._control_block = nullptr;
+    }
+
+    CompactSharedPtr& operator=(const CompactSharedPtr& another) {
+        CompactSharedPtr(another).swap(*this);
+        return *this;
+    }
+
+    CompactSharedPtr& operator=(CompactSharedPtr&& another) noexcept {
+        CompactSharedPtr(std::move(another)).swap(*this);
+        return *this;
+    }
+
+    pointer get() {
+        return object();
+    }
+
+    const_pointer get() const {
+        return object();
+    }
+
+    pointer operator->() {
+        return object();
+    }
+
+    const_pointer operator->() const {
+        return object();
+    }
+
+    reference operator*() {
+        return *object();
+    }
+
+    const_reference operator*() const {
+        return *object();
+    }
+
+    size_t use_count() const noexcept {
+        if (_control_block == nullptr) {
+            return 0;
+        }
+        return Policy::use_count(_control_block);
+    }
+
+    SharedPtr<T, Policy> share() const {
+        if (_control_block == nullptr) {
+            return SharedPtr<T, Policy>();
+        }
+        Policy::increment(_control_block, packed_counters::shared_one);
+        return SharedPtr<T, Policy>(object(), _control_block);
+    }
+
+    void reset() {
+        CompactSharedPtr().swap(*this);
+    }
+
+    ~CompactSharedPtr() {
+        if (_control_block == nullptr) {
+            return;
+        }
+        uint64_t left =
+            Policy::decrement(_control_block, packed_counters::shared_one);
+        if (packed_counters::shared(left) == 0) {
+            Policy::expire(_control_block, left);
+        }
+    }
+
+    void swap(CompactSharedPtr& another) noexcept {
+        std::swap(_control_block, another._control_block);
+    }
+
+  private:
+    // adopts the reference of a SharedPtr made by allocateShared
+    explicit CompactSharedPtr(SharedPtr<T, Policy>&& shared)
+        : _control_block(shared._control_block) {
+        shared._ptr = nullptr;
+        shared._control_block = nullptr;
+    }
+
+    T* object() const noexcept {
+        if (_control_block == nullptr) {
+            return nullptr;
+        }
+        return &static_cast<block_type*>(_control_block)->_object;
+    }
+
+    block_pointer _control_block = nullptr;
+};
+
+template <typename T, typename Policy = multi_threaded,
+          typename Allocator = typename default_block_allocator<T>::type,
+          typename... Args>
+CompactSharedPtr<T, Policy, Allocator> allocateCompact(
+    const Allocator& allocator = Allocator(), Args&&... args) {
+    static_assert(!std::is_array_v<T>, "arrays need a SharedPtr");
+    static_assert(!out_of_line_object<T>::value,
+                  "objects placed out of line need a SharedPtr");
+    return CompactSharedPtr<T, Policy, Allocator>(
+        allocateShared<T, Policy, Allocator>(allocator,
+                                             std::forward<Args>(args)...));
+}
+
+template <typename T, typename Policy = multi_threaded, typename... Args>
+CompactSharedPtr<T, Policy> makeCompact(Args&&... args) {
+    using allocator = typename default_block_allocator<T>::type;
+    return allocateCompact<T, Policy>(allocator(),
+                                      std::forward<Args>(args)...);
+}
+
+#endif  //SHAREDPTR_COMPACT_SHARED_PTR_H
@@ -0,0 +1,367 @@
+#ifndef SHAREDPTR_CYCLE_COLLECTOR_H
+#define SHAREDPTR_CYCLE_COLLECTOR_H
+
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "smart_pointers.h"
+
+// Trial-deletion cycle collection (Bacon and Rajan) for SharedPtrs with the
+// cycle_collected policy.
+//
+// A type takes part by exposing `void trace(CycleTracer&) const`, which
+// passes each of its cycle_collected SharedPtr members to the tracer; other
+// types are leaves and cannot be part of a cycle. Whenever a strong count of
+// a traceable object drops without reaching zero, its block becomes a
+// candidate root and is buffered by the thread's CycleCollector. A
+// collection subtracts the references which candidates and everything
+// reachable from them hold among themselves; whatever is left without
+// external references is garbage and destroyed. Collections run when the
+// buffer reaches its threshold, so each pause only covers the graph reachable
+// from a bounded number of candidates, or explicitly through collect().
+//
+// Counting is single-threaded: objects and their SharedPtrs stay on one
+// thread, which also owns the candidate buffer.
+
+class CycleTracer;
+
+struct cycle_block : base_block {
+    using trace_function = void (*)(const void*, size_t, CycleTracer&);
+
+    // black: in use, gray: counted in a trial deletion, white: garbage,
+    // purple: candidate root
+    enum class color : uint8_t { black, gray, white, purple };
+
+    cycle_block(size_t shared, size_t weak,
+                const block_operations* operations)
+        : base_block(shared, weak, operations) {}
+
+    size_t count() const noexcept {
+        return packed_counters::shared(
+            _counters.load(std::memory_order_relaxed));
+    }
+
+    // set by adopt() for traceable objects only; arrays have _count elements
+    const void* _object = nullptr;
+    size_t _count = 1;
+    trace_function _trace = nullptr;
+    color _color = color::black;
+    bool _buffered = false;
+};
+
+template <typename T>
+concept traceable = requires(const T& object, CycleTracer& tracer) {
+    object.trace(tracer);
+};
+
+// Receives the SharedPtr members of a traced object.
+class CycleTracer {
+  public:
+    CycleTracer(const CycleTracer&) = delete;
+    CycleTracer& operator=(const CycleTracer&) = delete;
+
+    template <typename U, typename Policy>
+    void operator()(const SharedPtr<U, Policy>& child) {
+        static_assert(std::is_same_v<typename Policy::block_header,
+                                     cycle_block>,
+                      "only cycle_collected pointers can be traced");
+        auto* block = static_cast<cycle_block*>(child._control_block);
+        if (block != nullptr && block->_trace != nullptr) {
+            _children->push_back(block);
+        }
+    }
+
+  private:
+    friend class CycleCollector;
+
+    explicit CycleTracer(std::vector<cycle_block*>* children)
+        : _children(children) {}
+
+    std::vector<cycle_block*>* _children;
+};
+
+class CycleCollector {
+  public:
+    static constexpr size_t default_threshold = 1024;
+
+    CycleCollector(const CycleCollector&) = delete;
+    CycleCollector& operator=(const CycleCollector&) = delete;
+
+    // collector of the calling thread; nullptr while its thread-local
+    // objects are destroyed
+    static CycleCollector* local() noexcept {
+        thread_local bool finished = false;
+        if (finished) {
+            return nullptr;
+        }
+        thread_local CycleCollector collector(&finished);
+        return &collector;
+    }
+
+    // frees the garbage cycles among the buffered candidates; returns the
+    // number of objects destroyed
+    size_t collect() {
+        if (_collecting) {
+            return 0;
+        }
+        _collecting = true;
+        std::vector<cycle_block*> roots;
+        roots.swap(_roots);
+        std::vector<cycle_block*> marked;
+        for (cycle_block* root : roots) {
+            if (root->_color == cycle_block::color::purple &&
+                root->count() > 0) {
+                mark_gray(root);
+                marked.push_back(root);
+            } else {
+                root->_buffered = false;
+                unpin(root);
+            }
+        }
+        for (cycle_block* root : marked) {
+            scan(root);
+        }
+        std::vector<cycle_block*> garbage;
+        for (cycle_block* root : marked) {
+            root->_buffered = false;
+            collect_white(root, garbage);
+        }
+        release_garbage(garbage);
+        for (cycle_block* root : marked) {
+            unpin(root);
+        }
+        _collecting = false;
+        return garbage.size();
+    }
+
+    // buffered candidates trigger a collection once there are this many
+    void set_threshold(size_t threshold) noexcept {
+        _threshold = threshold == 0 ? 1 : threshold;
+    }
+
+    size_t candidates() const noexcept {
+        return _roots.size();
+    }
+
+    // a strong count of block has dropped but not to zero
+    void possible_root(cycle_block* block) {
+        if (block->_color == cycle_block::color::purple) {
+            return;
+        }
+        block->_color = cycle_block::color::purple;
+        if (block->_buffered) {
+            return;
+        }
+        // the buffer's weak reference keeps the block until it is examined
+        block->_buffered = true;
+        single_threaded::increment(block, packed_counters::weak_one);
+        _roots.push_back(block);
+        if (_roots.size() >= _threshold) {
+            collect();
+        }
+    }
+
+    // what is buffered when the thread exits is collected once more
+    ~CycleCollector() {
+        while (!_roots.empty()) {
+            collect();
+        }
+        *_finished = true;
+    }
+
+  private:
+    using color = cycle_block::color;
+
+    explicit CycleCollector(bool* finished) : _finished(finished) {}
+
+    static void unpin(cycle_block* block) {
+        if (packed_counters::weak(single_threaded::decrement(
+                block, packed_counters::weak_one)) == 0) {
+            block->deallocate();
+        }
+    }
+
+    void children(cycle_block* block, std::vector<cycle_block*>& out) {
+        out.clear();
+        CycleTracer tracer(&out);
+        block->_trace(block->_object, block->_count, tracer);
+    }
+
+    // subtracts the references held by block and everything it reaches
+    void mark_gray(cycle_block* block) {
+        if (block->_color == color::gray) {
+            return;
+        }
+        block->_color = color::gray;
+        std::vector<cycle_block*> stack = {block};
+        std::vector<cycle_block*> next;
+        while (!stack.empty()) {
+            cycle_block* current = stack.back();
+            stack.pop_back();
+            children(current, next);
+            for (cycle_block* child : next) {
+                single_threaded::decrement(child, packed_counters::shared_one);
+                if (child->_color != color::gray) {
+                    child->_color = color::gray;
+                    stack.push_back(child);
+                }
+            }
+        }
+    }
+
+    // gray blocks keeping external references are live again, the others
+    // become white
+    void scan(cycle_block* block) {
+        std::vector<cycle_block*> stack = {block};
+        std::vector<cycle_block*> next;
+        while (!stack.empty()) {
+            cycle_block* current = stack.back();
+            stack.pop_back();
+            if (current->_color != color::gray) {
+                continue;
+            }
+            if (current->count() > 0) {
+                scan_black(current);
+                continue;
+            }
+            current->_color = color::white;
+            children(current, next);
+            stack.insert(stack.end(), next.begin(), next.end());
+        }
+    }
+
+    // restores the references held by block and everything it reaches
+    void scan_black(cycle_block* block) {
+        block->_color = color::black;
+        std::vector<cycle_block*> stack = {block};
+        std::vector<cycle_block*> next;
+        while (!stack.empty()) {
+            cycle_block* current = stack.back();
+            stack.pop_back();
+            children(current, next);
+            for (cycle_block* child : next) {
+                single_threaded::increment(child, packed_counters::shared_one);
+                if (child->_color != color::black) {
+                    child->_color = color::black;
+                    stack.push_back(child);
+                }
+            }
+        }
+    }
+
+    void collect_white(cycle_block* block,
+                       std::vector<cycle_block*>& garbage) {
+        std::vector<cycle_block*> stack = {block};
+        std::vector<cycle_block*> next;
+        while (!stack.empty()) {
+            cycle_block* current = stack.back();
+            stack.pop_back();
+            if (current->_color != color::white || current->_buffered) {
+                continue;
+            }
+            current->_color = color::black;
+            garbage.push_back(current);
+            children(current, next);
+            stack.insert(stack.end(), next.begin(), next.end());
+        }
+    }
+
+    // The references among the garbage are restored, so the destructors
+    // release them as usual, and every block is held by one extra reference
+    // meanwhile; the objects are destroyed one by one and the blocks freed
+    // afterwards, so the stack stays flat however long the cycle is.
+    void release_garbage(std::vector<cycle_block*>& garbage) {
+        std::vector<cycle_block*> next;
+        for (cycle_block* block : garbage) {
+            children(block, next);
+            for (cycle_block* child : next) {
+                single_threaded::increment(child, packed_counters::shared_one);
+            }
+        }
+        for (cycle_block* block : garbage) {
+            single_threaded::increment(block, packed_counters::shared_one);
+            // keeps the releases by other garbage out of the buffer
+            block->_buffered = true;
+        }
+        for (cycle_block* block : garbage) {
+            block->destroy();
+        }
+        for (cycle_block* block : garbage) {
+            block->_buffered = false;
+            block->_color = color::black;
+            single_threaded::decrement(block, packed_counters::shared_one);
+            unpin(block);
+        }
+    }
+
+    std::vector<cycle_block*> _roots;
+    size_t _threshold = default_threshold;
+    bool _collecting = false;
+    bool* _finished;
+};
+
+// Single-threaded counting which buffers candidate roots for the thread's
+// CycleCollector.
+struct cycle_collected : basic_policy<cycle_collected> {
+    using block_header = cycle_block;
+    static constexpr bool thread_confined = true;
+
+    template <typename U>
+    static void adopt(base_block* block, U* object, size_t count = 1) noexcept {
+        if constexpr (traceable<U>) {
+            auto* self = static_cast<cycle_block*>(block);
+            self->_object = object;
+            self->_count = count;
+            self->_trace = &trace<U>;
+        }
+    }
+
+    static void increment(base_block* block, uint64_t unit) noexcept {
+        single_threaded::increment(block, unit);
+        if (unit == packed_counters::shared_one) {
+            static_cast<cycle_block*>(block)->_color =
+                cycle_block::color::black;
+        }
+    }
+
+    static uint64_t decrement(base_block* block, uint64_t unit) {
+        uint64_t left = single_threaded::decrement(block, unit);
+        if (unit != packed_counters::shared_one) {
+            return left;
+        }
+        auto* self = static_cast<cycle_block*>(block);
+        if (packed_counters::shared(left) == 0) {
+            self->_color = cycle_block::color::black;
+        } else if (self->_trace != nullptr) {
+            if (CycleCollector* collector = CycleCollector::local()) {
+                collector->possible_root(self);
+            }
+        }
+        return left;
+    }
+
+    static bool increment_if_nonzero(base_block* block,
+                                     uint64_t unit) noexcept {
+        if (!single_threaded::increment_if_nonzero(block, unit)) {
+            return false;
+        }
+        if (unit == packed_counters::shared_one) {
+            static_cast<cycle_block*>(block)->_color =
+                cycle_block::color::black;
+        }
+        return true;
+    }
+
+    template <typename U>
+    static void trace(const void* object, size_t count, CycleTracer& tracer) {
+        const U* first = static_cast<const U*>(object);
+        for (size_t i = 0; i < count; ++i) {
+            first[i].trace(tracer);
+        }
+    }
+};
+
+#endif  //SHAREDPTR_CYCLE_COLLECTOR_H
@@ -0,0 +1,376 @@
+#ifndef SHAREDPTR_EPOCH_RECLAMATION_H
+#define SHAREDPTR_EPOCH_RECLAMATION_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "smart_pointers.h"
+
+// Epoch-based reclamation of control blocks.
+//
+// Readers enter the current global epoch with an EpochGuard and may then use
+// raw pointers to objects owned by epoch_release<...> SharedPtrs without
+// touching any counter. When such an object loses its last SharedPtr, the
+// block is put on the limbo list of the releasing thread, tagged with the
+// global epoch, instead of being destroyed. The epoch advances once every
+// reader inside a section has entered the current one; a block retired in
+// epoch e is expired by Base once the global epoch reaches e + 2, when no
+// reader which could have seen its object is left. Every thread has a record
+// with its epoch and its limbo list. Records are never freed: an exiting
+// thread leaves its limbo list to the domain and frees its record for the
+// next thread.
+
+struct epoch_record {
+    using expire_function = void (*)(base_block*, uint64_t);
+
+    // the epoch the thread's reader section has entered, shifted left by
+    // one, with the lowest bit set while the thread is inside it
+    static constexpr uint64_t active = 1;
+
+    struct limbo_entry {
+        expire_function _expire;
+        base_block* _block;
+        uint64_t _left;
+        uint64_t _epoch;
+    };
+
+    std::atomic<uint64_t> _state = 0;
+    // touched by the owner thread only
+    size_t _depth = 0;
+    size_t _retired_since_collect = 0;
+    bool _collecting = false;
+    std::vector<limbo_entry> _limbo;
+    std::atomic<bool> _claimed = false;
+    epoch_record* _next = nullptr;
+};
+
+class EpochDomain {
+  public:
+    using expire_function = epoch_record::expire_function;
+
+    // a thread tries to advance the epoch after this many releases
+    static constexpr size_t collect_interval = 64;
+
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+
+    static EpochDomain& instance() {
+        static EpochDomain domain;
+        return domain;
+    }
+
+    // record of the calling thread; nullptr while its thread-local objects
+    // are destroyed
+    epoch_record* local() {
+        thread_local epoch_record* own = nullptr;
+        thread_local bool finished = false;
+        if (own == nullptr && !finished) {
+            own = claim();
+            thread_local exit_guard guard(this, &own, &finished);
+        }
+        return own;
+    }
+
+    void enter(epoch_record* record) noexcept {
+        if (record->_depth++ != 0) {
+            return;
+        }
+        uint64_t epoch = _epoch.load(std::memory_order_relaxed);
+        record->_state.store(epoch << 1 | epoch_record::active,
+                             std::memory_order_relaxed);
+        // the announcement is visible before anything read in the section
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    void leave(epoch_record* record) noexcept {
+        if (--record->_depth != 0) {
+            return;
+        }
+        record->_state.store(0, std::memory_order_release);
+    }
+
+    // expire(block, left) runs once no reader can reach the block any more
+    void retire(expire_function expire, base_block* block, uint64_t left) {
+        // the unlinking of the object is ordered before the epoch read
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t epoch = _epoch.load(std::memory_order_relaxed);
+        epoch_record* own = local();
+        if (own == nullptr) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _orphans.push_back({expire, block, left, epoch});
+            return;
+        }
+        own->_limbo.push_back({expire, block, left, epoch});
+        if (++own->_retired_since_collect >= collect_interval) {
+            collect(own);
+        }
+    }
+
+    // advances the epoch as far as the readers allow and expires the blocks
+    // of the calling thread and of exited threads which have become safe;
+    // returns their number
+    size_t collect() {
+        return collect(local());
+    }
+
+    // waits until every reader section which has begun before the call has
+    // ended, then collects; never call it inside a section
+    void synchronize() {
+        uint64_t target = epoch() + 2;
+        while (true) {
+            collect();
+            if (epoch() >= target) {
+                return;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    epoch_record* claim() {
+        for (epoch_record* record = _records.load(std::memory_order_acquire);
+             record != nullptr; record = record->_next) {
+            bool expected = false;
+            if (!record->_claimed.load(std::memory_order_relaxed) &&
+                record->_claimed.compare_exchange_strong(
+                    expected, true, std::memory_order_acquire)) {
+                return record;
+            }
+        }
+        auto* record = new epoch_record();
+        record->_claimed.store(true, std::memory_order_relaxed);
+        record->_next = _records.load(std::memory_order_relaxed);
+        while (!_records.compare_exchange_weak(record->_next, record,
+                                               std::memory_order_release,
+                                               std::memory_order_relaxed)) {
+        }
+        return record;
+    }
+
+    // the record must not be inside a reader section
+    void release(epoch_record* record) {
+        if (!record->_limbo.empty()) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _orphans.insert(_orphans.end(), record->_limbo.begin(),
+                            record->_limbo.end());
+            record->_limbo.clear();
+        }
+        record->_claimed.store(false, std::memory_order_release);
+    }
+
+    uint64_t epoch() const noexcept {
+        return _epoch.load(std::memory_order_acquire);
+    }
+
+    // no reader is left once the program exits; expiring may retire more
+    ~EpochDomain() {
+        bool expired = true;
+        while (expired) {
+            expired = expire_all(_orphans);
+            for (epoch_record* record =
+                     _records.load(std::memory_order_acquire);
+                 record != nullptr; record = record->_next) {
+                expired = expire_all(record->_limbo) || expired;
+            }
+        }
+    }
+
+  private:
+    using limbo_entry = epoch_record::limbo_entry;
+
+    class exit_guard {
+      public:
+        exit_guard(EpochDomain* domain, epoch_record** own, bool* finished)
+            : _domain(domain), _own(own), _finished(finished) {}
+
+        exit_guard(const exit_guard&) = delete;
+        exit_guard& operator=(const exit_guard&) = delete;
+
+        ~exit_guard() {
+            epoch_record* record = *_own;
+            _domain->collect(record);
+            *_own = nullptr;
+            *_finished = true;
+            _domain->release(record);
+        }
+
+      private:
+        EpochDomain* _domain;
+        epoch_record** _own;
+        bool* _finished;
+    };
+
+    EpochDomain() = default;
+
+    // moves the global epoch on if every active reader has entered it
+    bool try_advance() {
+        uint64_t epoch = _epoch.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for (epoch_record* record = _records.load(std::memory_order_acquire);
+             record != nullptr; record = record->_next) {
+            uint64_t state = record->_state.load(std::memory_order_acquire);
+            if ((state & epoch_record::active) != 0 && state >> 1 != epoch) {
+                return false;
+            }
+        }
+        return _epoch.compare_exchange_strong(epoch, epoch + 1,
+                                              std::memory_order_acq_rel,
+                                              std::memory_order_relaxed);
+    }
+
+    size_t collect(epoch_record* own) {
+        if (own != nullptr) {
+            if (own->_collecting) {
+                return 0;
+            }
+            own->_collecting = true;
+            own->_retired_since_collect = 0;
+        }
+        // two steps make everything retired before this call safe
+        try_advance();
+        try_advance();
+        uint64_t safe = _epoch.load(std::memory_order_acquire);
+        std::vector<limbo_entry> candidates;
+        if (own != nullptr) {
+            candidates.swap(own->_limbo);
+        }
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            candidates.insert(candidates.end(), _orphans.begin(),
+                              _orphans.end());
+            _orphans.clear();
+        }
+        size_t expired = 0;
+        std::vector<limbo_entry> kept;
+        for (const limbo_entry& entry : candidates) {
+            if (entry._epoch + 2 > safe) {
+                kept.push_back(entry);
+                continue;
+            }
+            // may retire more, which then waits in the limbo list
+            entry._expire(entry._block, entry._left);
+            ++expired;
+        }
+        if (own != nullptr) {
+            own->_collecting = false;
+            own->_limbo.insert(own->_limbo.end(), kept.begin(), kept.end());
+        } else {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _orphans.insert(_orphans.end(), kept.begin(), kept.end());
+        }
+        return expired;
+    }
+
+    static bool expire_all(std::vector<limbo_entry>& entries) {
+        bool any = !entries.empty();
+        while (!entries.empty()) {
+            limbo_entry entry = entries.back();
+            entries.pop_back();
+            entry._expire(entry._block, entry._left);
+        }
+        return any;
+    }
+
+    std::atomic<uint64_t> _epoch = 0;
+    std::atomic<epoch_record*> _records = nullptr;
+    std::mutex _mutex;
+    std::vector<limbo_entry> _orphans;
+};
+
+// Reader section: objects of epoch_release<...> blocks which were reachable
+// when it began stay alive until it ends. Sections nest.
+class EpochGuard {
+  public:
+    EpochGuard() : _record(EpochDomain::instance().local()) {
+        if (_record == nullptr) {
+            // the thread is exiting; it borrows a record of its own
+            _record = EpochDomain::instance().claim();
+            _borrowed = true;
+        }
+        EpochDomain::instance().enter(_record);
+    }
+
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+
+    ~EpochGuard() {
+        EpochDomain::instance().leave(_record);
+        if (_borrowed) {
+            EpochDomain::instance().release(_record);
+        }
+    }
+
+  private:
+    epoch_record* _record;
+    bool _borrowed = false;
+};
+
+// Puts expired blocks on the limbo list of the current epoch; Base::expire
+// runs once the readers of that epoch are gone.
+template <typename Base>
+struct epoch_release : Base {
+    static_assert(!Base::thread_confined,
+                  "blocks of a thread_confined policy cannot be expired by "
+                  "another thread");
+
+    static constexpr bool recyclable = false;
+
+    static void expire(base_block* block, uint64_t left) {
+        EpochDomain::instance().retire(&Base::expire, block, left);
+    }
+};
+
+// Slot which readers inside an EpochGuard read as a raw pointer.
+//
+// The slot owns a SharedPtr and publishes its object pointer separately;
+// writers are serialized by a mutex. A replaced object is released by the
+// writer, and epoch_release keeps it alive for the readers which may still
+// use the old pointer.
+template <typename T, typename Policy = epoch_release<multi_threaded>>
+class EpochSlot {
+    static_assert(!Policy::thread_confined,
+                  "a slot cannot share thread_confined pointers");
+
+  public:
+    using value_type = SharedPtr<T, Policy>;
+    using element_type = std::remove_extent_t<T>;
+
+    EpochSlot() = default;
+
+    explicit EpochSlot(SharedPtr<T, Policy> value)
+        : _object(value.get()), _owner(std::move(value)) {}
+
+    EpochSlot(const EpochSlot&) = delete;
+    EpochSlot& operator=(const EpochSlot&) = delete;
+
+    // valid until the caller's EpochGuard ends
+    element_type* get() const noexcept {
+        return _object.load(std::memory_order_acquire);
+    }
+
+    SharedPtr<T, Policy> load() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _owner;
+    }
+
+    void store(SharedPtr<T, Policy> value) {
+        exchange(std::move(value));
+    }
+
+    SharedPtr<T, Policy> exchange(SharedPtr<T, Policy> value) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _object.store(value.get(), std::memory_order_release);
+        _owner.swap(value);
+        return value;
+    }
+
+  private:
+    std::atomic<element_type*> _object = nullptr;
+    mutable std::mutex _mutex;
+    SharedPtr<T, Policy> _owner;
+};
+
+#endif  //SHAREDPTR_EPOCH_RECLAMATION_H
@@ -0,0 +1,412 @@
+#ifndef SHAREDPTR_HAZARD_POINTERS_H
+#define SHAREDPTR_HAZARD_POINTERS_H
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "smart_pointers.h"
+
+// Hazard pointers: memory reached through shared slots is read without
+// touching any reference count.
+//
+// A reader publishes the address it is about to dereference in a hazard of
+// its thread and checks that the slot still holds that address; the memory
+// then stays valid until the hazard is cleared. A writer retires what it has
+// unlinked, and a later scan reclaims every retired pointer which no hazard
+// names. Each thread has a record with its hazards and its retire list.
+// Records are never freed: an exiting thread scans once more, leaves what is
+// still protected to the domain and frees its record for the next thread.
+
+struct hazard_record {
+    using reclaim_function = void (*)(void*);
+
+    static constexpr size_t hazards = 8;
+
+    struct retired_entry {
+        void* _pointer;
+        reclaim_function _reclaim;
+    };
+
+    std::atomic<void*> _hazards[hazards] = {};
+    // which hazards are handed out, touched by the owner thread only
+    unsigned _taken = 0;
+    bool _scanning = false;
+    std::vector<retired_entry> _retired;
+    std::atomic<bool> _claimed = false;
+    hazard_record* _next = nullptr;
+};
+
+class HazardDomain {
+  public:
+    using reclaim_function = hazard_record::reclaim_function;
+
+    // a thread scans once this many pointers are retired, or twice the
+    // number of hazards if that is larger
+    static constexpr size_t scan_threshold = 64;
+
+    HazardDomain(const HazardDomain&) = delete;
+    HazardDomain& operator=(const HazardDomain&) = delete;
+
+    static HazardDomain& instance() {
+        static HazardDomain domain;
+        return domain;
+    }
+
+    // record of the calling thread; nullptr while its thread-local objects
+    // are destroyed
+    hazard_record* local() {
+        thread_local hazard_record* own = nullptr;
+        thread_local bool finished = false;
+        if (own == nullptr && !finished) {
+            own = claim();
+            thread_local exit_guard guard(this, &own, &finished);
+        }
+        return own;
+    }
+
+    // reclaim(pointer) is called once no hazard names pointer any more
+    void retire(void* pointer, reclaim_function reclaim) {
+        hazard_record* own = local();
+        if (own == nullptr) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _orphans.push_back({pointer, reclaim});
+            return;
+        }
+        own->_retired.push_back({pointer, reclaim});
+        if (!own->_scanning && own->_retired.size() >= threshold()) {
+            scan(own);
+        }
+    }
+
+    // reclaims the unprotected pointers retired by the calling thread and
+    // by exited threads; returns their number
+    size_t scan() {
+        return scan(local());
+    }
+
+    hazard_record* claim() {
+        for (hazard_record* record = _records.load(std::memory_order_acquire);
+             record != nullptr; record = record->_next) {
+            bool expected = false;
+            if (!record->_claimed.load(std::memory_order_relaxed) &&
+                record->_claimed.compare_exchange_strong(
+                    expected, true, std::memory_order_acquire)) {
+                return record;
+            }
+        }
+        auto* record = new hazard_record();
+        record->_claimed.store(true, std::memory_order_relaxed);
+        record->_next = _records.load(std::memory_order_relaxed);
+        while (!_records.compare_exchange_weak(record->_next, record,
+                                               std::memory_order_release,
+                                               std::memory_order_relaxed)) {
+        }
+        _record_count.fetch_add(1, std::memory_order_relaxed);
+        return record;
+    }
+
+    // the record's hazards must be clear
+    void release(hazard_record* record) {
+        if (!record->_retired.empty()) {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _orphans.insert(_orphans.end(), record->_retired.begin(),
+                            record->_retired.end());
+            record->_retired.clear();
+        }
+        record->_claimed.store(false, std::memory_order_release);
+    }
+
+    // no reader is left once the program exits; reclaiming may retire more
+    ~HazardDomain() {
+        bool reclaimed = true;
+        while (reclaimed) {
+            reclaimed = reclaim_all(_orphans);
+            for (hazard_record* record =
+                     _records.load(std::memory_order_acquire);
+                 record != nullptr; record = record->_next) {
+                reclaimed = reclaim_all(record->_retired) || reclaimed;
+            }
+        }
+    }
+
+  private:
+    using retired_entry = hazard_record::retired_entry;
+
+    class exit_guard {
+      public:
+        exit_guard(HazardDomain* domain, hazard_record** own, bool* finished)
+            : _domain(domain), _own(own), _finished(finished) {}
+
+        exit_guard(const exit_guard&) = delete;
+        exit_guard& operator=(const exit_guard&) = delete;
+
+        ~exit_guard() {
+            hazard_record* record = *_own;
+            _domain->scan(record);
+            *_own = nullptr;
+            *_finished = true;
+            _domain->release(record);
+        }
+
+      private:
+        HazardDomain* _domain;
+        hazard_record** _own;
+        bool* _finished;
+    };
+
+    HazardDomain() = default;
+
+    size_t threshold() const noexcept {
+        return std::max(scan_threshold,
+                        2 * hazard_record::hazards *
+                            _record_count.load(std::memory_order_relaxed));
+    }
+
+    size_t scan(hazard_record* own) {
+        std::vector<retired_entry> candidates;
+        if (own != nullptr) {
+            candidates.swap(own->_retired);
+            own->_scanning = true;
+        }
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            candidates.insert(candidates.end(), _orphans.begin(),
+                              _orphans.end());
+            _orphans.clear();
+        }
+        // pairs with the fence of a reader between publishing its hazard
+        // and checking the slot again
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::vector<void*> protected_pointers;
+        for (hazard_record* record = _records.load(std::memory_order_acquire);
+             record != nullptr; record = record->_next) {
+            for (const std::atomic<void*>& hazard : record->_hazards) {
+                if (void* pointer = hazard.load(std::memory_order_acquire)) {
+                    protected_pointers.push_back(pointer);
+                }
+            }
+        }
+        std::sort(protected_pointers.begin(), protected_pointers.end());
+        size_t reclaimed = 0;
+        std::vector<retired_entry> kept;
+        for (const retired_entry& entry : candidates) {
+            if (std::binary_search(protected_pointers.begin(),
+                                   protected_pointers.end(),
+                                   entry._pointer)) {
+                kept.push_back(entry);
+                continue;
+            }
+            // may retire more, which then waits for the next scan
+            entry._reclaim(entry._pointer);
+            ++reclaimed;
+        }
+        if (own != nullptr) {
+            own->_scanning = false;
+            own->_retired.insert(own->_retired.end(), kept.begin(),
+                                 kept.end());
+        } else {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _orphans.insert(_orphans.end(), kept.begin(), kept.end());
+        }
+        return reclaimed;
+    }
+
+    static bool reclaim_all(std::vector<retired_entry>& entries) {
+        bool any = !entries.empty();
+        while (!entries.empty()) {
+            retired_entry entry = entries.back();
+            entries.pop_back();
+            entry._reclaim(entry._pointer);
+        }
+        return any;
+    }
+
+    std::atomic<hazard_record*> _records = nullptr;
+    std::atomic<size_t> _record_count = 0;
+    std::mutex _mutex;
+    std::vector<retired_entry> _orphans;
+};
+
+// One hazard of the calling thread, cleared and handed back on destruction.
+// A thread may hold hazard_record::hazards guards at once.
+class HazardGuard {
+  public:
+    HazardGuard() : _record(HazardDomain::instance().local()) {
+        if (_record == nullptr) {
+            // the thread is exiting; it borrows a record of its own
+            _record = HazardDomain::instance().claim();
+            _borrowed = true;
+        }
+        unsigned free = ~_record->_taken;
+        if ((free & ((1u << hazard_record::hazards) - 1)) == 0) {
+            std::terminate();
+        }
+        _index = static_cast<size_t>(std::countr_zero(free));
+        _record->_taken |= 1u << _index;
+    }
+
+    HazardGuard(const HazardGuard&) = delete;
+    HazardGuard& operator=(const HazardGuard&) = delete;
+
+    ~HazardGuard() {
+        reset();
+        _record->_taken &= ~(1u << _index);
+        if (_borrowed) {
+            HazardDomain::instance().release(_record);
+        }
+    }
+
+    // returns the current value of source, which stays valid until the
+    // guard is reset or destroyed
+    template <typename P>
+    P* protect(const std::atomic<P*>& source) noexcept {
+        std::atomic<void*>& hazard = _record->_hazards[_index];
+        P* seen = source.load(std::memory_order_relaxed);
+        while (true) {
+            hazard.store(const_cast<void*>(static_cast<const void*>(seen)),
+                         std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            P* current = source.load(std::memory_order_acquire);
+            if (current == seen) {
+                return seen;
+            }
+            seen = current;
+        }
+    }
+
+    void reset() noexcept {
+        _record->_hazards[_index].store(nullptr, std::memory_order_release);
+    }
+
+  private:
+    hazard_record* _record;
+    size_t _index = 0;
+    bool _borrowed = false;
+};
+
+// Slot holding a SharedPtr<T> whose object readers reach without copying it.
+//
+// As in AtomicSharedPtr the stored SharedPtr lives in an immutable holder;
+// read() protects the holder with a hazard, so a reader costs a fence and no
+// reference count update. store() retires the replaced holder, whose
+// SharedPtr is released, and its object possibly destroyed, by the scan which
+// finds it unprotected.
+template <typename T, typename Policy = multi_threaded>
+class HazardSlot {
+    static_assert(!Policy::thread_confined,
+                  "a slot cannot share thread_confined pointers");
+
+    struct holder {
+        explicit holder(SharedPtr<T, Policy>&& value)
+            : _value(std::move(value)) {}
+
+        SharedPtr<T, Policy> _value;
+    };
+
+  public:
+    using value_type = SharedPtr<T, Policy>;
+    using element_type = std::remove_extent_t<T>;
+
+    // Keeps the object which the slot held when it was created alive.
+    class ReadGuard {
+      public:
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+
+        element_type* get() const noexcept {
+            return _holder == nullptr ? nullptr : _holder->_value.get();
+        }
+
+        element_type* operator->() const noexcept {
+            return get();
+        }
+
+        element_type& operator*() const noexcept {
+            return *get();
+        }
+
+        explicit operator bool() const noexcept {
+            return get() != nullptr;
+        }
+
+        // a counted reference which outlives the guard
+        SharedPtr<T, Policy> share() const {
+            return _holder == nullptr ? SharedPtr<T, Policy>()
+                                      : _holder->_value;
+        }
+
+      private:
+        friend class HazardSlot;
+
+        explicit ReadGuard(const std::atomic<holder*>& source)
+            : _holder(_guard.protect(source)) {}
+
+        HazardGuard _guard;
+        holder* _holder;
+    };
+
+    HazardSlot() = default;
+
+    explicit HazardSlot(SharedPtr<T, Policy> value)
+        : _holder(make_holder(std::move(value))) {}
+
+    HazardSlot(const HazardSlot&) = delete;
+    HazardSlot& operator=(const HazardSlot&) = delete;
+
+    ReadGuard read() const {
+        return ReadGuard(_holder);
+    }
+
+    SharedPtr<T, Policy> load() const {
+        return read().share();
+    }
+
+    void store(SharedPtr<T, Policy> value) {
+        retire(_holder.exchange(make_holder(std::move(value)),
+                                std::memory_order_acq_rel));
+    }
+
+    SharedPtr<T, Policy> exchange(SharedPtr<T, Policy> value) {
+        holder* old = _holder.exchange(make_holder(std::move(value)),
+                                       std::memory_order_acq_rel);
+        if (old == nullptr) {
+            return SharedPtr<T, Policy>();
+        }
+        SharedPtr<T, Policy> result = old->_value;
+        retire(old);
+        return result;
+    }
+
+    // guards may still protect the last holder
+    ~HazardSlot() {
+        retire(_holder.load(std::memory_order_relaxed));
+    }
+
+  private:
+    static holder* make_holder(SharedPtr<T, Policy>&& value) {
+        if (value.get() == nullptr && value.use_count() == 0) {
+            return nullptr;
+        }
+        return new holder(std::move(value));
+    }
+
+    static void retire(holder* old) {
+        if (old != nullptr) {
+            HazardDomain::instance().retire(old, &reclaim);
+        }
+    }
+
+    static void reclaim(void* pointer) {
+        delete static_cast<holder*>(pointer);
+    }
+
+    std::atomic<holder*> _holder = nullptr;
+};
+
+#endif  //SHAREDPTR_HAZARD_POINTERS_H
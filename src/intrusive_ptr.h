@@ -0,0 +1,460 @@
+#ifndef SHAREDPTR_INTRUSIVE_PTR_H
+#define SHAREDPTR_INTRUSIVE_PTR_H
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <exception>
+#include <type_traits>
+#include <utility>
+
+#include "smart_pointers.h"
+
+// Reference counting inside the object: T derives from
+// IntrusiveRefCounted<T, Policy>, and IntrusivePtr<T> is a single pointer.
+//
+// The object keeps one word which holds its strong count shifted left by
+// one. The first IntrusiveWeakPtr moves the count to a side block and stores
+// the block's tagged address instead; from then on the object
+// is counted through the side block exactly like a SharedPtr, so weak
+// references can outlive the object. Deleting through T* requires a virtual
+// destructor when IntrusivePtrs to derived types are created.
+
+// Updates of the inline word. Once a side block is installed, the word holds
+// its address in the high 48 bits, the tag in bit 0 and a scratch field in
+// between: a racing update adds to the scratch field, finds the tag and
+// takes its change back before going to the side block, which keeps the
+// inline path at a single fetch_add or fetch_sub. Block addresses must fit
+// into 48 bits, as user-space addresses do with 4-level paging; with 5-level
+// paging the kernel only hands out higher ones to processes which map them
+// explicitly. Debug builds check every block.
+template <typename Policy>
+struct intrusive_counter {
+    static_assert(sizeof(uintptr_t) == sizeof(uint64_t),
+                  "pointer packing requires a 64-bit address space");
+
+    static constexpr uintptr_t side_tag = 1;
+    static constexpr uintptr_t one = 2;
+    static constexpr int address_shift = 16;
+    // leaves room for concurrent stray updates in either direction
+    static constexpr uintptr_t scratch = uintptr_t(1) << (address_shift - 2);
+
+    static uintptr_t tag(base_block* block) noexcept {
+        auto address = reinterpret_cast<uintptr_t>(block);
+        assert(address >> (64 - address_shift) == 0);
+        return address << address_shift | scratch | side_tag;
+    }
+
+    static base_block* block_of(uintptr_t word) noexcept {
+        return reinterpret_cast<base_block*>(word >> address_shift);
+    }
+
+    // returns the word seen; an odd word was left as it was
+    static uintptr_t increment(std::atomic<uintptr_t>& refs) noexcept {
+        uintptr_t word = refs.fetch_add(one, std::memory_order_acquire);
+        if ((word & side_tag) != 0) {
+            refs.fetch_sub(one, std::memory_order_relaxed);
+        } else if (word / one == packed_counters::half_mask) {
+            std::terminate();
+        }
+        return word;
+    }
+
+    // returns the word seen; the last reference is gone if it was one
+    static uintptr_t decrement(std::atomic<uintptr_t>& refs) noexcept {
+        uintptr_t word = refs.fetch_sub(one, std::memory_order_acq_rel);
+        if ((word & side_tag) != 0) {
+            refs.fetch_add(one, std::memory_order_relaxed);
+        }
+        return word;
+    }
+
+    static bool install(std::atomic<uintptr_t>& refs, uintptr_t& expected,
+                        uintptr_t side) noexcept {
+        return refs.compare_exchange_strong(expected, side,
+                                            std::memory_order_acq_rel,
+                                            std::memory_order_acquire);
+    }
+};
+
+template <>
+struct intrusive_counter<single_threaded> : intrusive_counter<void> {
+    static uintptr_t increment(std::atomic<uintptr_t>& refs) noexcept {
+        uintptr_t word = refs.load(std::memory_order_relaxed);
+        if ((word & side_tag) == 0) {
+            if (word / one == packed_counters::half_mask) {
+                std::terminate();
+            }
+            refs.store(word + one, std::memory_order_relaxed);
+        }
+        return word;
+    }
+
+    static uintptr_t decrement(std::atomic<uintptr_t>& refs) noexcept {
+        uintptr_t word = refs.load(std::memory_order_relaxed);
+        if ((word & side_tag) == 0) {
+            refs.store(word - one, std::memory_order_relaxed);
+        }
+        return word;
+    }
+
+    static bool install(std::atomic<uintptr_t>& refs,
+                        uintptr_t& /*expected*/, uintptr_t side) noexcept {
+        refs.store(side, std::memory_order_relaxed);
+        return true;
+    }
+};
+
+// Control block of an object which has been weakly referenced; the strong
+// owners hold one weak reference, as with the other blocks.
+template <typename T>
+struct intrusive_side_block : public base_block {
+    intrusive_side_block(size_t shared, T* object)
+        : base_block(shared, 1, &operations), _object(object) {}
+
+    T* _object;
+
+    static void destroy_block(base_block* block) {
+        delete static_cast<intrusive_side_block*>(block)->_object;
+    }
+
+    static void deallocate_block(base_block* block) {
+        delete static_cast<intrusive_side_block*>(block);
+    }
+
+    static void dispose_block(base_block* block) {
+        destroy_block(block);
+        deallocate_block(block);
+    }
+
+    static constexpr block_operations operations = {
+        &destroy_block, &deallocate_block, &dispose_block};
+};
+
+template <typename T>
+class IntrusivePtr;
+
+template <typename T>
+class IntrusiveWeakPtr;
+
+template <typename T, typename Policy = multi_threaded>
+class IntrusiveRefCounted {
+    static_assert(std::is_same_v<typename Policy::block_header, base_block>,
+                  "side blocks have the plain base_block header");
+
+    using counter = intrusive_counter<Policy>;
+    using side_block = intrusive_side_block<T>;
+
+  public:
+    using intrusive_policy = Policy;
+
+  protected:
+    IntrusiveRefCounted() = default;
+
+    // a copy is a new object with a count of its own
+    IntrusiveRefCounted(const IntrusiveRefCounted& /*unused*/) noexcept {}
+
+    IntrusiveRefCounted& operator=(
+        const IntrusiveRefCounted& /*unused*/) noexcept {
+        return *this;
+    }
+
+    ~IntrusiveRefCounted() = default;
+
+  private:
+    template <typename U>
+    friend class IntrusivePtr;
+
+    template <typename U>
+    friend class IntrusiveWeakPtr;
+
+    void add_ref() const noexcept {
+        uintptr_t word = counter::increment(_refs);
+        if ((word & counter::side_tag) != 0) {
+            Policy::increment(counter::block_of(word),
+                              packed_counters::shared_one);
+        }
+    }
+
+    void release() const {
+        uintptr_t word = counter::decrement(_refs);
+        if ((word & counter::side_tag) == 0) {
+            if (word == counter::one) {
+                delete static_cast<const T*>(this);
+            }
+            return;
+        }
+        base_block* block = counter::block_of(word);
+        uint64_t left =
+            Policy::decrement(block, packed_counters::shared_one);
+        if (packed_counters::shared(left) == 0) {
+            Policy::expire(block, left);
+        }
+    }
+
+    size_t use_count() const noexcept {
+        uintptr_t word = _refs.load(std::memory_order_acquire);
+        if ((word & counter::side_tag) != 0) {
+            return Policy::use_count(counter::block_of(word));
+        }
+        return word / counter::one;
+    }
+
+    // moves the count to a side block unless there is one already; the
+    // caller holds a strong reference, so the count is never zero here
+    base_block* side() const {
+        uintptr_t word = _refs.load(std::memory_order_acquire);
+        if ((word & counter::side_tag) != 0) {
+            return counter::block_of(word);
+        }
+        auto* block = new side_block(
+            word / counter::one,
+            const_cast<T*>(static_cast<const T*>(this)));
+        while (!counter::install(_refs, word, counter::tag(block))) {
+            if ((word & counter::side_tag) != 0) {
+                delete block;
+                return counter::block_of(word);
+            }
+            block->_counters.store(
+                packed_counters::make(word / counter::one, 1),
+                std::memory_order_relaxed);
+        }
+        return block;
+    }
+
+    mutable std::atomic<uintptr_t> _refs = 0;
+};
+
+template <typename T>
+class IntrusivePtr {
+  public:
+    using type = T;
+    using pointer = T*;
+    using const_pointer = const T*;
+    using reference = T&;
+    using const_reference = const T&;
+    using threading_policy = typename T::intrusive_policy;
+
+    template <typename U>
+    friend class IntrusivePtr;
+
+    template <typename U>
+    friend class IntrusiveWeakPtr;
+
+    IntrusivePtr() = default;
+
+    // the object may already be owned by other IntrusivePtrs
+    template <typename U>
+    IntrusivePtr(U* ptr) : _ptr(ptr) {
+        if (_ptr != nullptr) {
+            _ptr->add_ref();
+        }
+    }
+
+    IntrusivePtr(const IntrusivePtr& another) : _ptr(another._ptr) {
+        if (_ptr != nullptr) {
+            _ptr->add_ref();
+        }
+    }
+
+    template <typename U>
+    IntrusivePtr(const IntrusivePtr<U>& another) : _ptr(another._ptr) {
+        if (_ptr != nullptr) {
+            _ptr->add_ref();
+        }
+    }
+
+    IntrusivePtr(IntrusivePtr&& another) noexcept : _ptr(another._ptr) {
+        another._ptr = nullptr;
+    }
+
+    template <typename U>
+    IntrusivePtr(IntrusivePtr<U>&& another) noexcept : _ptr(another._ptr) {
+        another._ptr = nullptr;
+    }
+
+    IntrusivePtr& operator=(const IntrusivePtr& another) {
+        IntrusivePtr(another).swap(*this);
+        return *this;
+    }
+
+    template <typename U>
+    IntrusivePtr& operator=(const IntrusivePtr<U>& another) {
+        IntrusivePtr(another).swap(*this);
+        return *this;
+    }
+
+    IntrusivePtr& operator=(IntrusivePtr&& another) noexcept {
+        IntrusivePtr(std::move(another)).swap(*this);
+        return *this;
+    }
+
+    template <typename U>
+    IntrusivePtr& operator=(IntrusivePtr<U>&& another) noexcept {
+        IntrusivePtr(std::move(another)).swap(*this);
+        return *this;
+    }
+
+    pointer get() {
+        return _ptr;
+    }
+
+    const_pointer get() const {
+        return _ptr;
+    }
+
+    pointer operator->() {
+        return _ptr;
+    }
+
+    const_pointer operator->() const {
+        return _ptr;
+    }
+
+    reference operator*() {
+        return *_ptr;
+    }
+
+    const_reference operator*() const {
+        return *_ptr;
+    }
+
+    size_t use_count() const noexcept {
+        if (_ptr == nullptr) {
+            return 0;
+        }
+        return _ptr->use_count();
+    }
+
+    void reset() {
+        IntrusivePtr().swap(*this);
+    }
+
+    template <typename U>
+    void reset(U* ptr) {
+        IntrusivePtr(ptr).swap(*this);
+    }
+
+    ~IntrusivePtr() {
+        if (_ptr != nullptr) {
+            _ptr->release();
+        }
+    }
+
+    void swap(IntrusivePtr& another) noexcept {
+        std::swap(_ptr, another._ptr);
+    }
+
+  private:
+    struct adopt {};
+
+    // takes over a strong reference which is already counted
+    IntrusivePtr(T* ptr, adopt /*unused*/) : _ptr(ptr) {}
+
+    pointer _ptr = nullptr;
+};
+
+template <typename T, typename... Args>
+IntrusivePtr<T> makeIntrusive(Args&&... args) {
+    return IntrusivePtr<T>(new T(std::forward<Args>(args)...));
+}
+
+template <typename T>
+class IntrusiveWeakPtr {
+    using policy = typename T::intrusive_policy;
+
+  public:
+    using type = T;
+    using pointer = T*;
+    using const_pointer = const T*;
+    using reference = T&;
+    using const_reference = const T&;
+    using block = base_block;
+    using block_pointer = base_block*;
+    using threading_policy = policy;
+
+    template <typename U>
+    friend class IntrusiveWeakPtr;
+
+    IntrusiveWeakPtr() = default;
+
+    IntrusiveWeakPtr(const IntrusiveWeakPtr& another)
+        : _ptr(another._ptr), _control_block(another._control_block) {
+        if (_control_block != nullptr) {
+            policy::increment(_control_block, packed_counters::weak_one);
+        }
+    }
+
+    template <typename U>
+    IntrusiveWeakPtr(const IntrusiveWeakPtr<U>& another)
+        : _ptr(another._ptr), _control_block(another._control_block) {
+        if (_control_block != nullptr) {
+            policy::increment(_control_block, packed_counters::weak_one);
+        }
+    }
+
+    IntrusiveWeakPtr(IntrusiveWeakPtr&& another) noexcept
+        : _ptr(another._ptr), _control_block(another._control_block) {
+        another._ptr = nullptr;
+        another._control_block = nullptr;
+    }
+
+    template <typename U>
+    IntrusiveWeakPtr(const IntrusivePtr<U>& another) : _ptr(another._ptr) {
+        if (_ptr != nullptr) {
+            _control_block = another._ptr->side();
+            policy::increment(_control_block, packed_counters::weak_one);
+        }
+    }
+
+    IntrusiveWeakPtr& operator=(const IntrusiveWeakPtr& another) {
+        IntrusiveWeakPtr(another).swap(*this);
+        return *this;
+    }
+
+    IntrusiveWeakPtr& operator=(IntrusiveWeakPtr&& another) noexcept {
+        IntrusiveWeakPtr(std::move(another)).swap(*this);
+        return *this;
+    }
+
+    IntrusivePtr<T> lock() const noexcept {
+        if (_control_block == nullptr ||
+            !policy::increment_if_nonzero(_control_block,
+                                          packed_counters::shared_one)) {
+            return IntrusivePtr<T>();
+        }
+        return IntrusivePtr<T>(_ptr, typename IntrusivePtr<T>::adopt());
+    }
+
+    size_t use_count() const noexcept {
+        if (_control_block == nullptr) {
+            return 0;
+        }
+        return policy::use_count(_control_block);
+    }
+
+    bool expired() const noexcept {
+        return use_count() == 0;
+    }
+
+    ~IntrusiveWeakPtr() {
+        if (_control_block == nullptr) {
+            return;
+        }
+        if (packed_counters::weak(policy::decrement(
+                _control_block, packed_counters::weak_one)) == 0) {
+            _control_block->deallocate();
+        }
+    }
+
+    void swap(IntrusiveWeakPtr& another) noexcept {
+        std::swap(_ptr, another._ptr);
+        std::swap(_control_block, another._control_block);
+    }
+
+  private:
+    pointer _ptr = nullptr;
+    block_pointer _control_block = nullptr;
+};
+
+#endif  //SHAREDPTR_INTRUSIVE_PTR_H
@@ -0,0 +1,97 @@
+#ifndef SHAREDPTR_LOCAL_SHARED_PTR_H
+#define SHAREDPTR_LOCAL_SHARED_PTR_H
+
+#include <type_traits>
+#include <utility>
+
+#include "smart_pointers.h"
+
+// SharedPtr with plain counters for objects which never leave the thread
+// that created them, e.g. those of a per-request arena.
+//
+// A LocalSharedPtr<T> is a SharedPtr<T, single_threaded>: it uses the same
+// regular_block and shared_block storage and WeakPtr<T, single_threaded>
+// observes it. Being a type of its own, it never converts to a thread-safe
+// SharedPtr implicitly, and as single_threaded is thread_confined,
+// HazardSlot, EpochSlot, RcuPtr and background_release refuse it at compile
+// time. A lambda handed to std::thread can still capture one, which the
+// language gives no way to forbid.
+//
+// toShared() and toLocalShared() move an object between the two kinds of
+// counting. The block only changes hands while the converted pointer is its
+// sole owner and no WeakPtr observes it, as any other reference would go on
+// updating the counters the old way; otherwise the result is empty and the
+// argument keeps its object.
+template <typename T>
+class LocalSharedPtr : public SharedPtr<T, single_threaded> {
+    using base = SharedPtr<T, single_threaded>;
+
+    // moves the reference of source to target if it is the only one
+    template <typename From, typename To>
+    static void hand_over(SharedPtr<T, From>& source,
+                          SharedPtr<T, To>& target) noexcept {
+        static_assert(
+            std::is_same_v<typename From::block_header, base_block> &&
+                std::is_same_v<typename To::block_header, base_block>,
+            "only blocks with the plain base_block header change policy");
+        if (source._control_block == nullptr ||
+            !From::unique(source._control_block)) {
+            return;
+        }
+        target._ptr = std::exchange(source._ptr, nullptr);
+        target._control_block = std::exchange(source._control_block, nullptr);
+    }
+
+  public:
+    using base::base;
+
+    LocalSharedPtr() = default;
+
+    // the counting of single_threaded pointers is the same
+    LocalSharedPtr(base shared) noexcept : base(std::move(shared)) {}
+
+    template <typename U, typename Policy>
+    friend SharedPtr<U, Policy> toShared(LocalSharedPtr<U>&& local);
+
+    template <typename U, typename Policy>
+    friend LocalSharedPtr<U> toLocalShared(SharedPtr<U, Policy>&& shared);
+};
+
+// Hands the object of local over to thread-safe counting if local owns it
+// alone; the result is empty otherwise.
+template <typename T, typename Policy = multi_threaded>
+SharedPtr<T, Policy> toShared(LocalSharedPtr<T>&& local) {
+    static_assert(!Policy::thread_confined,
+                  "the target policy must count across threads");
+    SharedPtr<T, Policy> result;
+    LocalSharedPtr<T>::hand_over(local, result);
+    return result;
+}
+
+// Confines the object of shared to the calling thread if shared owns it
+// alone; the result is empty otherwise. Objects of policies whose expire()
+// keeps them for readers, such as epoch_release, must not be reachable by
+// any reader any more.
+template <typename T, typename Policy>
+LocalSharedPtr<T> toLocalShared(SharedPtr<T, Policy>&& shared) {
+    LocalSharedPtr<T> result;
+    LocalSharedPtr<T>::hand_over(shared, result);
+    return result;
+}
+
+template <typename T,
+          typename Allocator =
+              typename default_block_allocator<std::remove_extent_t<T>>::type,
+          typename... Args>
+LocalSharedPtr<T> allocateLocalShared(const Allocator& allocator,
+                                      Args&&... args) {
+    return allocateShared<T, single_threaded>(allocator,
+                                              std::forward<Args>(args)...);
+}
+
+template <typename T, typename... Args>
+LocalSharedPtr<T> makeLocalShared(Args&&... args) {
+    return makeShared<T, single_threaded>(std::forward<Args>(args)...);
+}
+
+#endif  //SHAREDPTR_LOCAL_SHARED_PTR_H
@@ -0,0 +1,228 @@
+#ifndef SHAREDPTR_POOL_ALLOCATOR_H
+#define SHAREDPTR_POOL_ALLOCATOR_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+#include "smart_pointers.h"
+
+// Size-class pool for control blocks and other small allocations.
+//
+// Every thread allocates from its own cache holding one free list per 16-byte
+// size class. Memory is carved from 64 KiB slabs aligned to their size, and
+// the slab header names the cache which carved it. A chunk freed by the
+// thread owning that cache goes straight back to the local free list; a
+// chunk freed by any other thread is pushed to the cache's lock-free return
+// queue, which the owner takes over with a single exchange once its local
+// list runs dry. Caches of finished threads are parked and adopted by new
+// threads, so chunks which outlive their thread stay valid.
+
+struct pool_chunk {
+    pool_chunk* _next;
+};
+
+struct pool_cache;
+
+struct pool_slab {
+    pool_cache* _owner;
+};
+
+struct pool_cache {
+    static constexpr size_t granularity = 16;
+    static constexpr size_t class_count = 16;
+    static constexpr size_t max_size = granularity * class_count;
+    static constexpr size_t slab_size = size_t(1) << 16;
+
+    static size_t size_class(size_t size) noexcept {
+        return size == 0 ? 0 : (size - 1) / granularity;
+    }
+
+    static pool_slab* slab_of(void* ptr) noexcept {
+        return reinterpret_cast<pool_slab*>(reinterpret_cast<uintptr_t>(ptr) &
+                                            ~(slab_size - 1));
+    }
+
+    void* allocate(size_t size_class) {
+        pool_chunk* chunk = _free[size_class];
+        if (chunk == nullptr) {
+            chunk = _returned[size_class].exchange(nullptr,
+                                                   std::memory_order_acquire);
+        }
+        if (chunk == nullptr) {
+            chunk = carve(size_class);
+        }
+        _free[size_class] = chunk->_next;
+        return chunk;
+    }
+
+    // called by the thread owning the cache only
+    void deallocate(void* ptr, size_t size_class) noexcept {
+        auto* chunk = static_cast<pool_chunk*>(ptr);
+        chunk->_next = _free[size_class];
+        _free[size_class] = chunk;
+    }
+
+    // called by any other thread
+    void give_back(void* ptr, size_t size_class) noexcept {
+        auto* chunk = static_cast<pool_chunk*>(ptr);
+        chunk->_next = _returned[size_class].load(std::memory_order_relaxed);
+        while (!_returned[size_class].compare_exchange_weak(
+            chunk->_next, chunk, std::memory_order_release,
+            std::memory_order_relaxed)) {
+        }
+    }
+
+    pool_chunk* carve(size_t size_class) {
+        size_t chunk_size = (size_class + 1) * granularity;
+        auto* slab = static_cast<pool_slab*>(
+            ::operator new(slab_size, std::align_val_t(slab_size)));
+        slab->_owner = this;
+        char* begin = reinterpret_cast<char*>(slab) + granularity;
+        size_t count = (slab_size - granularity) / chunk_size;
+        pool_chunk* head = nullptr;
+        for (size_t i = count; i > 0; --i) {
+            auto* chunk =
+                reinterpret_cast<pool_chunk*>(begin + (i - 1) * chunk_size);
+            chunk->_next = head;
+            head = chunk;
+        }
+        return head;
+    }
+
+    pool_chunk* _free[class_count] = {};
+    std::atomic<pool_chunk*> _returned[class_count] = {};
+    pool_cache* _next_parked = nullptr;
+};
+
+class pool_registry {
+  public:
+    static pool_cache* adopt() {
+        std::lock_guard<std::mutex> lock(mutex());
+        pool_cache*& parked = parked_caches();
+        if (parked == nullptr) {
+            return new pool_cache();
+        }
+        pool_cache* cache = parked;
+        parked = cache->_next_parked;
+        return cache;
+    }
+
+    static void park(pool_cache* cache) {
+        std::lock_guard<std::mutex> lock(mutex());
+        pool_cache*& parked = parked_caches();
+        cache->_next_parked = parked;
+        parked = cache;
+    }
+
+  private:
+    static std::mutex& mutex() {
+        static std::mutex instance;
+        return instance;
+    }
+
+    static pool_cache*& parked_caches() {
+        static pool_cache* instance = nullptr;
+        return instance;
+    }
+};
+
+class pool_thread_guard {
+  public:
+    pool_thread_guard(pool_cache** cache, bool* finished)
+        : _cache(cache), _finished(finished) {}
+
+    pool_thread_guard(const pool_thread_guard&) = delete;
+    pool_thread_guard& operator=(const pool_thread_guard&) = delete;
+
+    ~pool_thread_guard() {
+        pool_registry::park(*_cache);
+        *_cache = nullptr;
+        *_finished = true;
+    }
+
+  private:
+    pool_cache** _cache;
+    bool* _finished;
+};
+
+// returns nullptr while thread-local objects of the thread are destroyed
+inline pool_cache* local_pool_cache() {
+    thread_local pool_cache* cache = nullptr;
+    thread_local bool finished = false;
+    if (cache == nullptr && !finished) {
+        cache = pool_registry::adopt();
+        thread_local pool_thread_guard guard(&cache, &finished);
+    }
+    return cache;
+}
+
+inline bool is_pooled(size_t size, size_t alignment) noexcept {
+    return size <= pool_cache::max_size && alignment <= pool_cache::granularity;
+}
+
+inline void* pool_allocate(size_t size, size_t alignment) {
+    if (!is_pooled(size, alignment)) {
+        return ::operator new(size, std::align_val_t(alignment));
+    }
+    size_t size_class = pool_cache::size_class(size);
+    pool_cache* cache = local_pool_cache();
+    if (cache != nullptr) {
+        return cache->allocate(size_class);
+    }
+    // the thread is finishing: borrow a parked cache for a moment
+    cache = pool_registry::adopt();
+    void* ptr = cache->allocate(size_class);
+    pool_registry::park(cache);
+    return ptr;
+}
+
+inline void pool_deallocate(void* ptr, size_t size, size_t alignment) {
+    if (!is_pooled(size, alignment)) {
+        ::operator delete(ptr, std::align_val_t(alignment));
+        return;
+    }
+    size_t size_class = pool_cache::size_class(size);
+    pool_cache* owner = pool_cache::slab_of(ptr)->_owner;
+    if (owner == local_pool_cache()) {
+        owner->deallocate(ptr, size_class);
+    } else {
+        owner->give_back(ptr, size_class);
+    }
+}
+
+template <typename T>
+struct pool_allocator {
+    using value_type = T;
+
+    pool_allocator() = default;
+
+    template <typename U>
+    pool_allocator(const pool_allocator<U>& /*unused*/) noexcept {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(pool_allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* ptr, size_t n) noexcept {
+        pool_deallocate(ptr, n * sizeof(T), alignof(T));
+    }
+
+    template <typename U>
+    bool operator==(const pool_allocator<U>& /*unused*/) const noexcept {
+        return true;
+    }
+};
+
+// makeShared with the block and the object taken from the pool; to make the
+// pool the default for SharedPtr<T>(new T) and makeShared<T> as well,
+// specialize default_block_allocator<T> with type = pool_allocator<T>
+template <typename T, typename Policy = multi_threaded, typename... Args>
+SharedPtr<T, Policy> makePooled(Args&&... args) {
+    return allocateShared<T, Policy>(pool_allocator<T>(),
+                                     std::forward<Args>(args)...);
+}
+
+#endif  //SHAREDPTR_POOL_ALLOCATOR_H
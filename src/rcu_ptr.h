@@ -0,0 +1,131 @@
+#ifndef SHAREDPTR_RCU_PTR_H
+#define SHAREDPTR_RCU_PTR_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+
+#include "epoch_reclamation.h"
+#include "smart_pointers.h"
+
+// Read-copy-update around a SharedPtr<T> of any policy.
+//
+// Readers borrow the published object inside a read-side section, which is
+// an EpochGuard, and touch no counter. publish() replaces the object and
+// hands the reference of the old SharedPtr to EpochDomain, which drops it
+// after a grace period, i.e. once every section that could have seen the old
+// object has ended. The old object is therefore released by a later publish()
+// or collect(), or right away by synchronize(). Unlike EpochSlot the blocks
+// need no epoch_release policy, since only the slot's own reference waits.
+// Writers are serialized by a mutex.
+template <typename T, typename Policy = multi_threaded>
+class RcuPtr {
+    static_assert(!Policy::thread_confined,
+                  "RcuPtr cannot share thread_confined pointers");
+
+  public:
+    using value_type = SharedPtr<T, Policy>;
+    using element_type = std::remove_extent_t<T>;
+
+    // Read-side section holding the object published when it began.
+    class Borrow {
+      public:
+        Borrow(const Borrow&) = delete;
+        Borrow& operator=(const Borrow&) = delete;
+
+        element_type* get() const noexcept {
+            return _object;
+        }
+
+        element_type* operator->() const noexcept {
+            return _object;
+        }
+
+        element_type& operator*() const noexcept {
+            return *_object;
+        }
+
+        explicit operator bool() const noexcept {
+            return _object != nullptr;
+        }
+
+      private:
+        friend class RcuPtr;
+
+        explicit Borrow(const std::atomic<element_type*>& source)
+            : _object(source.load(std::memory_order_acquire)) {}
+
+        EpochGuard _section;
+        element_type* _object;
+    };
+
+    RcuPtr() = default;
+
+    explicit RcuPtr(SharedPtr<T, Policy> value)
+        : _object(value.get()), _current(std::move(value)) {}
+
+    RcuPtr(const RcuPtr&) = delete;
+    RcuPtr& operator=(const RcuPtr&) = delete;
+
+    Borrow read() const {
+        return Borrow(_object);
+    }
+
+    // for callers inside an EpochGuard of their own
+    element_type* get() const noexcept {
+        return _object.load(std::memory_order_acquire);
+    }
+
+    // a counted reference to the published object
+    SharedPtr<T, Policy> load() const {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _current;
+    }
+
+    void publish(SharedPtr<T, Policy> value) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _object.store(value.get(), std::memory_order_release);
+            _current.swap(value);
+        }
+        retire(std::move(value));
+        EpochDomain::instance().collect();
+    }
+
+    // waits for a grace period and drops what the calling thread retired
+    // before it; never call it inside a read-side section
+    static void synchronize() {
+        EpochDomain::instance().synchronize();
+    }
+
+    // sections may still borrow the last object
+    ~RcuPtr() {
+        retire(std::move(_current));
+    }
+
+  private:
+    static void retire(SharedPtr<T, Policy>&& previous) {
+        base_block* block = previous._control_block;
+        if (block == nullptr) {
+            return;
+        }
+        previous._ptr = nullptr;
+        previous._control_block = nullptr;
+        EpochDomain::instance().retire(&release, block, 0);
+    }
+
+    // drops the reference which retire() took over from the SharedPtr
+    static void release(base_block* block, uint64_t /*unused*/) {
+        uint64_t left = Policy::decrement(block, packed_counters::shared_one);
+        if (packed_counters::shared(left) == 0) {
+            Policy::expire(block, left);
+        }
+    }
+
+    std::atomic<element_type*> _object = nullptr;
+    mutable std::mutex _mutex;
+    SharedPtr<T, Policy> _current;
+};
+
+#endif  //SHAREDPTR_RCU_PTR_H
@@ -0,0 +1,130 @@
+#ifndef SHAREDPTR_REFCOUNT_BUFFER_H
+#define SHAREDPTR_REFCOUNT_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "smart_pointers.h"
+
+// Scope which coalesces the strong releases of buffered<...> SharedPtrs.
+//
+// While a RefcountBuffer is alive on a thread, dropping such a SharedPtr
+// there hands its reference to the buffer instead of decrementing the
+// counter, and a copy made there takes a reference back from the buffer if
+// it holds one for the block; only the other copies increment the counter.
+// Every SharedPtr thus owns a counted reference and may be released on any
+// thread. flush() drops what the buffer holds with one decrement per block,
+// so an object whose last SharedPtr was dropped inside the scope is
+// destroyed when the buffer is flushed. Buffers nest; the innermost one
+// collects the releases. use_count() and lock() keep working on the real
+// counts, which include the references held by the buffer.
+class RefcountBuffer {
+  public:
+    using settle_function = void (*)(base_block*, size_t);
+
+    static constexpr size_t capacity = 16;
+
+    RefcountBuffer() : _outer(active()) {
+        active() = this;
+    }
+
+    RefcountBuffer(const RefcountBuffer&) = delete;
+    RefcountBuffer& operator=(const RefcountBuffer&) = delete;
+
+    ~RefcountBuffer() {
+        flush();
+        active() = _outer;
+    }
+
+    // releases by destructors which run while flushing are flushed too
+    void flush() {
+        while (_size != 0) {
+            entry next = _entries[--_size];
+            if (next._count != 0) {
+                next._settle(next._block, next._count);
+            }
+        }
+    }
+
+    static RefcountBuffer*& active() noexcept {
+        thread_local RefcountBuffer* buffer = nullptr;
+        return buffer;
+    }
+
+    // takes over a strong reference to block
+    void hold(base_block* block, settle_function settle) {
+        for (size_t i = 0; i < _size; ++i) {
+            if (_entries[i]._block == block) {
+                ++_entries[i]._count;
+                return;
+            }
+        }
+        if (_size == capacity) {
+            flush();
+        }
+        _entries[_size++] = {block, 1, settle};
+    }
+
+    // hands back one of the references held for block, if there is any
+    bool take(base_block* block) noexcept {
+        for (size_t i = 0; i < _size; ++i) {
+            if (_entries[i]._block == block) {
+                if (_entries[i]._count == 0) {
+                    return false;
+                }
+                --_entries[i]._count;
+                return true;
+            }
+        }
+        return false;
+    }
+
+  private:
+    struct entry {
+        base_block* _block;
+        size_t _count;
+        settle_function _settle;
+    };
+
+    entry _entries[capacity];
+    size_t _size = 0;
+    RefcountBuffer* _outer;
+};
+
+// Sends strong releases to the active RefcountBuffer, if any, and lets
+// copies reuse the references it holds; weak counts and lock() always go to
+// Base.
+template <typename Base>
+struct buffered : Base {
+    // releases inside a scope wait for the flush
+    static constexpr bool recyclable = false;
+
+    static void increment(base_block* block, uint64_t unit) {
+        RefcountBuffer* buffer = RefcountBuffer::active();
+        if (buffer == nullptr || unit != packed_counters::shared_one ||
+            !buffer->take(block)) {
+            Base::increment(block, unit);
+        }
+    }
+
+    static uint64_t decrement(base_block* block, uint64_t unit) {
+        RefcountBuffer* buffer = RefcountBuffer::active();
+        if (buffer == nullptr || unit != packed_counters::shared_one) {
+            return Base::decrement(block, unit);
+        }
+        // the reference stays counted until the buffer is flushed
+        buffer->hold(block, &settle);
+        return packed_counters::shared_one;
+    }
+
+    // drops the references which the buffer held
+    static void settle(base_block* block, size_t count) {
+        uint64_t left =
+            Base::decrement_many(block, packed_counters::shared_one, count);
+        if (packed_counters::shared(left) == 0) {
+            Base::expire(block, left);
+        }
+    }
+};
+
+#endif  //SHAREDPTR_REFCOUNT_BUFFER_H
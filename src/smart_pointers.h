@@ -5,136 +5,671 @@
 #ifndef SHAREDPTR_SMART_POINTERS_H
 #define SHAREDPTR_SMART_POINTERS_H
 
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
 #include <iostream>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Strong and weak counts of a control block share one 64-bit word: the strong
+// count lives in the low half and the weak count in the high half, so the
+// last owner learns about remaining observers from the very same atomic
+// operation which dropped its reference.
+struct packed_counters {
+    static constexpr uint64_t shared_one = 1;
+    static constexpr uint64_t weak_one = uint64_t(1) << 32;
+    static constexpr uint64_t half_mask = weak_one - 1;
+
+    static constexpr uint64_t make(size_t shared, size_t weak) noexcept {
+        return shared * shared_one + weak * weak_one;
+    }
 
-template <typename T>
-class SharedPtr;
+    static constexpr size_t shared(uint64_t word) noexcept {
+        return word & half_mask;
+    }
+
+    static constexpr size_t weak(uint64_t word) noexcept {
+        return word / weak_one;
+    }
+
+    // the half of the word which is changed by adding unit
+    static constexpr size_t part(uint64_t word, uint64_t unit) noexcept {
+        return (word / unit) & half_mask;
+    }
+};
 
+// Allocator used for the control block (and, in makeShared, the object) when
+// none is given explicitly; specialize it to change the default for T.
 template <typename T>
-class WeakPtr;
+struct default_block_allocator {
+    using type = std::allocator<T>;
+};
 
+// Objects at least this large are placed out of line by makeShared.
+inline constexpr size_t out_of_line_threshold = size_t(64) << 10;
+
+// Whether makeShared / allocateShared allocate the object apart from its
+// control block, so that destroy() returns the object's memory at once while
+// WeakPtrs keep only the small block alive; specialize it to decide for T.
 template <typename T>
-class EnableSharedFromThis;
+struct out_of_line_object
+    : std::bool_constant<sizeof(T) >= out_of_line_threshold> {};
+
+struct base_block;
 
+// Requests default-initialization of the object or the array elements, as
+// done by makeSharedForOverwrite, instead of value-initialization.
+struct for_overwrite_t {
+    explicit for_overwrite_t() = default;
+};
+
+inline constexpr for_overwrite_t for_overwrite{};
+
+// Type-specific operations of a control block. Every block type owns one
+// static table of them instead of a vtable, so the release path costs a
+// single indirect call and there is no virtual destructor to run.
+struct block_operations {
+    void (*destroy)(base_block*);
+    void (*deallocate)(base_block*);
+    // destroy() immediately followed by deallocate()
+    void (*dispose)(base_block*);
+};
+
+// All strong references together own one weak reference, so the block
+// outlives destroy() even if the object drops the last WeakPtr to itself.
 struct base_block {
-    base_block(size_t shared, size_t weak)
-        : _shared_counter(shared), _weak_counter(weak){};
+    base_block(size_t shared, size_t weak, const block_operations* operations)
+        : _operations(operations),
+          _counters(packed_counters::make(shared, weak)){};
+
+    const block_operations* _operations;
+    std::atomic<uint64_t> _counters = 0;
+
+    size_t use_count() const noexcept {
+        return packed_counters::shared(
+            _counters.load(std::memory_order_relaxed));
+    }
 
-    size_t _shared_counter = 0;
-    size_t _weak_counter = 0;
+    void destroy() {
+        _operations->destroy(this);
+    }
 
-    virtual void destroy() = 0;
-    virtual void deallocate() = 0;
-    virtual ~base_block() = default;
+    void deallocate() {
+        _operations->deallocate(this);
+    }
+
+    void dispose() {
+        _operations->dispose(this);
+    }
 };
 
+// Header is base_block or the extended header a threading policy asks for.
 template <typename T, typename Deleter = std::default_delete<T>,
-          typename Allocator = std::allocator<T>>
-struct regular_block : public base_block {
+          typename Allocator = std::allocator<T>,
+          typename Header = base_block>
+struct regular_block : public Header {
+    using block_alloc = typename std::allocator_traits<
+        Allocator>::template rebind_alloc<regular_block>;
+
     regular_block(size_t shared, size_t weak, T* ptr)
-        : base_block(shared, weak), _pointer(ptr){};
+        : Header(shared, weak, &operations), _pointer(ptr){};
 
     regular_block(size_t shared, size_t weak, T* ptr, Deleter del)
-        : base_block(shared, weak), _pointer(ptr), _deleter(del){};
+        : Header(shared, weak, &operations),
+          _pointer(ptr),
+          _deleter(del){};
 
     regular_block(size_t shared, size_t weak, T* ptr, Deleter del,
                   Allocator alloc)
-        : base_block(shared, weak),
+        : Header(shared, weak, &operations),
           _pointer(ptr),
           _deleter(del),
           _allocator(alloc){};
 
+    // stateless deleters and allocators take no space in the block
     T* _pointer;
-    Deleter _deleter = Deleter();
-    Allocator _allocator = Allocator();
-
-    void destroy() override {
-        if (_pointer != nullptr) {
-            _deleter(_pointer);
-            _pointer = nullptr;
+    [[no_unique_address]] Deleter _deleter = Deleter();
+    [[no_unique_address]] Allocator _allocator = Allocator();
+
+    static void destroy_block(base_block* block) {
+        auto* self = static_cast<regular_block*>(block);
+        if (self->_pointer != nullptr) {
+            self->_deleter(self->_pointer);
+            self->_pointer = nullptr;
         }
     }
 
-    void deallocate() override {
-        using block_alloc =
-            typename std::allocator_traits<Allocator>::template rebind_alloc<
-                regular_block<T, Deleter, Allocator>>;
-        block_alloc alloc = _allocator;
-        std::allocator_traits<block_alloc>::deallocate(alloc, this, 1);
+    static void deallocate_block(base_block* block) {
+        auto* self = static_cast<regular_block*>(block);
+        block_alloc alloc = self->_allocator;
+        self->~regular_block();
+        std::allocator_traits<block_alloc>::deallocate(alloc, self, 1);
     }
 
-    ~regular_block() override = default;
+    static void dispose_block(base_block* block) {
+        destroy_block(block);
+        deallocate_block(block);
+    }
+
+    static constexpr block_operations operations = {
+        &destroy_block, &deallocate_block, &dispose_block};
 };
 
-template <typename T, typename Allocator = std::allocator<T>>
-struct shared_block : public base_block {
-    T _object;
-    Allocator _allocator = Allocator();
+// Block of allocateSharedOutOfLine: the object was built by the same
+// allocator in memory of its own, which destroy() hands back right away.
+template <typename T, typename Allocator = std::allocator<T>,
+          typename Header = base_block>
+struct out_of_line_block : public Header {
+    using object_alloc = typename std::allocator_traits<
+        Allocator>::template rebind_alloc<T>;
+    using block_alloc = typename std::allocator_traits<
+        Allocator>::template rebind_alloc<out_of_line_block>;
+
+    out_of_line_block(size_t shared, size_t weak, T* ptr, Allocator allocator)
+        : Header(shared, weak, &operations),
+          _pointer(ptr),
+          _allocator(allocator) {}
+
+    T* _pointer;
+    [[no_unique_address]] Allocator _allocator = Allocator();
+
+    static void destroy_block(base_block* block) {
+        auto* self = static_cast<out_of_line_block*>(block);
+        object_alloc alloc = self->_allocator;
+        std::allocator_traits<object_alloc>::destroy(alloc, self->_pointer);
+        std::allocator_traits<object_alloc>::deallocate(alloc, self->_pointer,
+                                                        1);
+        self->_pointer = nullptr;
+    }
+
+    static void deallocate_block(base_block* block) {
+        auto* self = static_cast<out_of_line_block*>(block);
+        block_alloc alloc = self->_allocator;
+        self->~out_of_line_block();
+        std::allocator_traits<block_alloc>::deallocate(alloc, self, 1);
+    }
+
+    static void dispose_block(base_block* block) {
+        destroy_block(block);
+        deallocate_block(block);
+    }
+
+    static constexpr block_operations operations = {
+        &destroy_block, &deallocate_block, &dispose_block};
+};
+
+// The object is a union member, so it is constructed and destroyed by the
+// block operations only and never by the block's own destructor.
+template <typename T, typename Allocator = std::allocator<T>,
+          typename Header = base_block>
+struct shared_block : public Header {
+    using block_alloc = typename std::allocator_traits<
+        Allocator>::template rebind_alloc<shared_block>;
+
+    union {
+        T _object;
+    };
+    [[no_unique_address]] Allocator _allocator = Allocator();
 
     template <typename... Args>
     shared_block(size_t shared, size_t weak, Allocator allocator,
                  Args&&... args)
-        : base_block(shared, weak),
+        : Header(shared, weak, &operations),
           _object(std::forward<Args>(args)...),
           _allocator(allocator) {}
 
-    void destroy() override {
-        std::allocator_traits<Allocator>::destroy(_allocator, &_object);
+    shared_block(size_t shared, size_t weak, Allocator allocator,
+                 for_overwrite_t /*unused*/)
+        : Header(shared, weak, &operations), _allocator(allocator) {
+        ::new (static_cast<void*>(&_object)) T;
     }
 
-    void deallocate() override {
-        using block_alloc = typename std::allocator_traits<
-            Allocator>::template rebind_alloc<shared_block<T, Allocator>>;
-        block_alloc alloc = _allocator;
-        std::allocator_traits<block_alloc>::deallocate(alloc, this, 1);
+    ~shared_block() {}
+
+    static void destroy_block(base_block* block) {
+        auto* self = static_cast<shared_block*>(block);
+        std::allocator_traits<Allocator>::destroy(self->_allocator,
+                                                  &self->_object);
+    }
+
+    static void deallocate_block(base_block* block) {
+        auto* self = static_cast<shared_block*>(block);
+        block_alloc alloc = self->_allocator;
+        self->~shared_block();
+        std::allocator_traits<block_alloc>::deallocate(alloc, self, 1);
+    }
+
+    static void dispose_block(base_block* block) {
+        destroy_block(block);
+        deallocate_block(block);
+    }
+
+    static constexpr block_operations operations = {
+        &destroy_block, &deallocate_block, &dispose_block};
+};
+
+template <size_t Alignment>
+struct alignas(Alignment) array_storage_unit {
+    unsigned char _bytes[Alignment];
+};
+
+// Block of makeShared<T[]>(n): the elements follow the block in the same
+// allocation, which is made in units aligned for both.
+template <typename T, typename Allocator = std::allocator<T>,
+          typename Header = base_block>
+struct shared_array_block : public Header {
+    using element_alloc = typename std::allocator_traits<
+        Allocator>::template rebind_alloc<T>;
+
+    shared_array_block(size_t shared, size_t weak, Allocator allocator,
+                       size_t size)
+        : Header(shared, weak, &operations),
+          _size(size),
+          _allocator(allocator) {}
+
+    size_t _size;
+    [[no_unique_address]] Allocator _allocator = Allocator();
+
+    // alignof(shared_array_block) from its parts, as the class is incomplete
+    static constexpr size_t alignment = std::max(
+        {alignof(Header), alignof(size_t), alignof(Allocator), alignof(T)});
+
+    using unit = array_storage_unit<alignment>;
+    using unit_alloc = typename std::allocator_traits<
+        Allocator>::template rebind_alloc<unit>;
+
+    static constexpr size_t elements_offset() noexcept {
+        return (sizeof(shared_array_block) + alignof(T) - 1) / alignof(T) *
+               alignof(T);
+    }
+
+    static size_t units(size_t size) noexcept {
+        return (elements_offset() + size * sizeof(T) + alignment - 1) /
+               alignment;
+    }
+
+    T* elements() noexcept {
+        return reinterpret_cast<T*>(reinterpret_cast<unsigned char*>(this) +
+                                    elements_offset());
+    }
+
+    // value-initializes the elements, default-initializes them for
+    // for_overwrite, or copies the value into each of them
+    template <typename... Value>
+    static shared_array_block* create(const Allocator& allocator, size_t size,
+                                      const Value&... value) {
+        static_assert(sizeof...(Value) <= 1, "at most one initial value");
+        if (size > (SIZE_MAX - elements_offset() - alignment) / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        unit_alloc alloc = allocator;
+        unit* memory = std::allocator_traits<unit_alloc>::allocate(
+            alloc, units(size));
+        auto* block = ::new (static_cast<void*>(memory))
+            shared_array_block(1, 1, allocator, size);
+        element_alloc elements = allocator;
+        T* first = block->elements();
+        size_t built = 0;
+        try {
+            for (; built < size; ++built) {
+                construct_element(elements, first + built, value...);
+            }
+        } catch (...) {
+            destroy_elements(elements, first, built);
+            block->~shared_array_block();
+            std::allocator_traits<unit_alloc>::deallocate(alloc, memory,
+                                                          units(size));
+            throw;
+        }
+        return block;
+    }
+
+    template <typename... Value>
+    static void construct_element(element_alloc& alloc, T* element,
+                                  const Value&... value) {
+        std::allocator_traits<element_alloc>::construct(alloc, element,
+                                                        value...);
+    }
+
+    static void construct_element(element_alloc& /*unused*/, T* element,
+                                  const for_overwrite_t& /*unused*/) {
+        ::new (static_cast<void*>(element)) T;
+    }
+
+    // in reverse order of construction
+    static void destroy_elements(element_alloc& alloc, T* first,
+                                 size_t count) {
+        while (count > 0) {
+            std::allocator_traits<element_alloc>::destroy(alloc,
+                                                          first + --count);
+        }
+    }
+
+    static void destroy_block(base_block* block) {
+        auto* self = static_cast<shared_array_block*>(block);
+        element_alloc alloc = self->_allocator;
+        destroy_elements(alloc, self->elements(), self->_size);
+    }
+
+    static void deallocate_block(base_block* block) {
+        auto* self = static_cast<shared_array_block*>(block);
+        unit_alloc alloc = self->_allocator;
+        size_t count = units(self->_size);
+        self->~shared_array_block();
+        std::allocator_traits<unit_alloc>::deallocate(
+            alloc, reinterpret_cast<unit*>(self), count);
+    }
+
+    static void dispose_block(base_block* block) {
+        destroy_block(block);
+        deallocate_block(block);
+    }
+
+    static constexpr block_operations operations = {
+        &destroy_block, &deallocate_block, &dispose_block};
+};
+
+// Defaults of a threading policy: blocks have the plain base_block header,
+// use_count() and unique() read the counters word, and expire() destroys the
+// object right away and deallocates the block as soon as no WeakPtr is left.
+template <typename Policy>
+struct basic_policy {
+    using block_header = base_block;
+
+    // the counters may be changed by any thread
+    static constexpr bool thread_confined = false;
+
+    // expire() releases at once, so a sole owner may destroy its object
+    // itself and reuse the block; policies which defer expire() clear it
+    static constexpr bool recyclable = true;
+
+    static size_t use_count(const base_block* block) noexcept {
+        return block->use_count();
+    }
+
+    // drops count units at once; returns the new value of the counters
+    static uint64_t decrement_many(base_block* block, uint64_t unit,
+                                   size_t count) {
+        uint64_t word = block->_counters.load(std::memory_order_relaxed);
+        for (; count != 0; --count) {
+            word = Policy::decrement(block, unit);
+        }
+        return word;
+    }
+
+    // called for every new block with the object it owns, or with the
+    // first element and the number of elements of an array block
+    template <typename U>
+    static void adopt(base_block* /*unused*/, U* /*unused*/,
+                      size_t /*unused*/ = 1) noexcept {}
+
+    // one strong reference and no WeakPtr, so the caller may recycle the
+    // block; the acquire load orders that after the former owners' releases
+    static bool unique(const base_block* block) noexcept {
+        return block->_counters.load(std::memory_order_acquire) ==
+               packed_counters::make(1, 1);
+    }
+
+    static void expire(base_block* block, uint64_t left) {
+        // without WeakPtrs nothing else can reach the block any more, so the
+        // owners' weak reference is dropped without another atomic operation
+        if (left == packed_counters::weak_one) {
+            block->dispose();
+            return;
+        }
+        block->destroy();
+        if (packed_counters::weak(
+                Policy::decrement(block, packed_counters::weak_one)) == 0) {
+            block->deallocate();
+        }
+    }
+};
+
+// Threading policies: they define how the counters of a control block are
+// changed. single_threaded keeps plain load/store updates, multi_threaded
+// uses lock-free read-modify-write operations. Both terminate the program
+// instead of letting a 32-bit count overflow into its neighbour.
+//
+// A policy also decides what happens once the last SharedPtr to a block is
+// gone: expire(block, left) receives the block and the value of its counters
+// right after the releasing decrement. Policies which keep more state per
+// block name a block_header derived from base_block; adopt(block, object,
+// count) lets them record the object or the elements of every new block.
+// Pointers of a thread_confined policy must stay on one thread, and the
+// facilities which hand SharedPtrs to other threads refuse them at compile
+// time.
+struct single_threaded : basic_policy<single_threaded> {
+    static constexpr bool thread_confined = true;
+
+    static void increment(base_block* block, uint64_t unit) noexcept {
+        std::atomic<uint64_t>& counters = block->_counters;
+        uint64_t word = counters.load(std::memory_order_relaxed);
+        if (packed_counters::part(word, unit) == packed_counters::half_mask) {
+            std::terminate();
+        }
+        counters.store(word + unit, std::memory_order_relaxed);
+    }
+
+    // returns the new value of the counters
+    static uint64_t decrement(base_block* block, uint64_t unit) noexcept {
+        return decrement_many(block, unit, 1);
+    }
+
+    static uint64_t decrement_many(base_block* block, uint64_t unit,
+                                   size_t count) noexcept {
+        std::atomic<uint64_t>& counters = block->_counters;
+        uint64_t word =
+            counters.load(std::memory_order_relaxed) - unit * count;
+        counters.store(word, std::memory_order_relaxed);
+        return word;
+    }
+
+    static bool increment_if_nonzero(base_block* block,
+                                     uint64_t unit) noexcept {
+        std::atomic<uint64_t>& counters = block->_counters;
+        uint64_t word = counters.load(std::memory_order_relaxed);
+        if (packed_counters::part(word, unit) == 0) {
+            return false;
+        }
+        increment(block, unit);
+        return true;
+    }
+};
+
+struct multi_threaded : basic_policy<multi_threaded> {
+    static void increment(base_block* block, uint64_t unit) noexcept {
+        std::atomic<uint64_t>& counters = block->_counters;
+        uint64_t word = counters.fetch_add(unit, std::memory_order_relaxed);
+        if (packed_counters::part(word, unit) == packed_counters::half_mask) {
+            std::terminate();
+        }
     }
 
-    ~shared_block() override = default;
+    // returns the new value of the counters; the releasing decrement is
+    // followed by an acquire fence, so the thread which drops the last
+    // reference sees every write made through the other references
+    static uint64_t decrement(base_block* block, uint64_t unit) noexcept {
+        return decrement_many(block, unit, 1);
+    }
+
+    // drops count units with a single read-modify-write
+    static uint64_t decrement_many(base_block* block, uint64_t unit,
+                                   size_t count) noexcept {
+        std::atomic<uint64_t>& counters = block->_counters;
+        uint64_t change = unit * count;
+        uint64_t word =
+            counters.fetch_sub(change, std::memory_order_release) - change;
+        if (packed_counters::part(word, unit) == 0) {
+            std::atomic_thread_fence(std::memory_order_acquire);
+        }
+        return word;
+    }
+
+    // a counter which has dropped to zero must never be revived, so the
+    // increment is only published if the observed value is not zero
+    static bool increment_if_nonzero(base_block* block,
+                                     uint64_t unit) noexcept {
+        std::atomic<uint64_t>& counters = block->_counters;
+        uint64_t word = counters.load(std::memory_order_relaxed);
+        do {
+            size_t value = packed_counters::part(word, unit);
+            if (value == 0) {
+                return false;
+            }
+            if (value == packed_counters::half_mask) {
+                std::terminate();
+            }
+        } while (!counters.compare_exchange_weak(word, word + unit,
+                                                 std::memory_order_acq_rel,
+                                                 std::memory_order_relaxed));
+        return true;
+    }
 };
 
+// Releases which happen while the thread is already expiring a block (e.g.
+// from the destructor of a list node) are queued and performed one by one by
+// the outermost expire(), so tearing down a long chain of SharedPtrs takes a
+// bounded amount of stack.
+template <typename Base>
+struct deferred_release : Base {
+    static constexpr bool recyclable = false;
+
+    static void expire(base_block* block, uint64_t left) {
+        thread_local release_queue queue;
+        if (queue._draining) {
+            queue._pending.emplace_back(block, left);
+            return;
+        }
+        queue._draining = true;
+        Base::expire(block, left);
+        while (!queue._pending.empty()) {
+            auto [next, next_left] = queue._pending.back();
+            queue._pending.pop_back();
+            Base::expire(next, next_left);
+        }
+        queue._draining = false;
+    }
+
+  private:
+    struct release_queue {
+        std::vector<std::pair<base_block*, uint64_t>> _pending;
+        bool _draining = false;
+    };
+};
+
+template <typename T, typename Policy = multi_threaded>
+class SharedPtr;
+
+template <typename T, typename Policy = multi_threaded>
+class WeakPtr;
+
+template <typename T, typename Policy = multi_threaded>
+class EnableSharedFromThis;
+
 template <typename T>
+class AtomicSharedPtr;
+
+template <typename T, typename Policy, typename Allocator>
+class CompactSharedPtr;
+
+template <typename T, typename Policy>
+class RcuPtr;
+
+class CycleTracer;
+
+template <typename T>
+class LocalSharedPtr;
+
+template <typename T, typename Policy>
 class SharedPtr {
-    SharedPtr(int val, T* ptr, base_block* control_block)
-        : _ptr(ptr), _control_block(control_block) {
-        if (_control_block != nullptr) {
-            _control_block->_shared_counter += val;
+    // adopts a strong reference which is already counted in control_block
+    SharedPtr(std::remove_extent_t<T>* ptr, base_block* control_block)
+        : _ptr(ptr), _control_block(control_block) {}
+
+    // derived-to-base conversions need no RTTI; anything else keeps the
+    // checked dynamic_cast of the converting constructors
+    template <typename U>
+    static std::remove_extent_t<T>* convert(U* ptr) noexcept {
+        // element pointers of arrays only gain qualifiers, never change type
+        static_assert(!std::is_array_v<T> ||
+                          std::is_convertible_v<U (*)[],
+                                                std::remove_extent_t<T> (*)[]>,
+                      "incompatible array element types");
+        if constexpr (std::is_convertible_v<U*, std::remove_extent_t<T>*>) {
+            return ptr;
+        } else {
+            return dynamic_cast<std::remove_extent_t<T>*>(ptr);
         }
     }
 
   public:
+    // arrays are held by a pointer to their first element
     using type = T;
-    using pointer = T*;
-    using const_pointer = const T*;
-    using reference = T&;
-    using const_reference = const T&;
+    using element_type = std::remove_extent_t<T>;
+    using pointer = element_type*;
+    using const_pointer = const element_type*;
+    using reference = element_type&;
+    using const_reference = const element_type&;
     using block = base_block;
     using block_pointer = base_block*;
+    using threading_policy = Policy;
 
-    template <typename U>
+    template <typename U, typename P>
     friend class SharedPtr;
 
-    template <typename U>
+    template <typename U, typename P>
     friend class WeakPtr;
 
-    template <typename U, typename Allocator, typename... Args>
-    friend SharedPtr<U> allocateShared(const Allocator& allocator,
-                                       Args&&... args);
+    template <typename U, typename P, typename Allocator, typename... Args>
+    friend SharedPtr<U, P> allocateShared(const Allocator& allocator,
+                                          Args&&... args);
 
-    template <typename U>
+    template <typename U, typename P, typename Allocator, typename... Args>
+    friend SharedPtr<U, P> allocateSharedOutOfLine(const Allocator& allocator,
+                                                   Args&&... args);
+
+    template <typename U, typename P>
     friend class EnableSharedFromThis;
 
+    template <typename U>
+    friend class AtomicSharedPtr;
+
+    template <typename U, typename P, typename Allocator>
+    friend class CompactSharedPtr;
+
+    template <typename U, typename P>
+    friend class RcuPtr;
+
+    friend class CycleTracer;
+
+    template <typename U>
+    friend class LocalSharedPtr;
+
+    // delete[] for SharedPtr<T[]> and SharedPtr<T[N]>
+    template <typename U>
+    using default_deleter = std::conditional_t<
+        std::is_array_v<T>, std::default_delete<std::remove_extent_t<T>[]>,
+        std::default_delete<U>>;
+
     SharedPtr() : _ptr(nullptr), _control_block(nullptr){};
 
-    template <typename U, typename Deleter = std::default_delete<U>,
-              typename Allocator = std::allocator<T>>
+    template <typename U, typename Deleter = default_deleter<U>,
+              typename Allocator = typename default_block_allocator<U>::type>
     SharedPtr(U* ptr, Deleter del = Deleter(),
               Allocator allocator = Allocator())
         : _ptr(ptr) {
-        using block_type = regular_block<U, Deleter, Allocator>;
+        using block_type = regular_block<U, Deleter, Allocator,
+                                         typename Policy::block_header>;
         using block_alloc = typename std::allocator_traits<
             Allocator>::template rebind_alloc<block_type>;
-        if constexpr (std::is_base_of_v<EnableSharedFromThis<U>, U>) {
-            SharedPtr<U> shared_ptr = ptr->shared_from_this();
+        if constexpr (std::is_base_of_v<EnableSharedFromThis<U, Policy>, U>) {
+            SharedPtr<U, Policy> shared_ptr = ptr->shared_from_this();
             if (shared_ptr.use_count() != 0) {
                 *this = shared_ptr;
                 return;
@@ -142,32 +677,50 @@ class SharedPtr {
             block_alloc alloc = allocator;
             _control_block =
                 std::allocator_traits<block_alloc>::allocate(alloc, 1);
-            new (_control_block) block_type(1, 0, ptr, del, allocator);
+            new (_control_block) block_type(1, 1, ptr, del, allocator);
+            Policy::adopt(_control_block, ptr);
             ptr->set_pointer(*this);
         } else {
             block_alloc alloc = allocator;
             _control_block =
                 std::allocator_traits<block_alloc>::allocate(alloc, 1);
-            new (_control_block) block_type(1, 0, ptr, del, allocator);
+            new (_control_block) block_type(1, 1, ptr, del, allocator);
+            Policy::adopt(_control_block, ptr);
         }
     }
 
     SharedPtr(const SharedPtr& another)
         : _ptr(another._ptr), _control_block(another._control_block) {
         if (_control_block != nullptr) {
-            _control_block->_shared_counter += 1;
+            Policy::increment(_control_block, packed_counters::shared_one);
         }
     }
 
     template <typename U>
-    SharedPtr(const SharedPtr<U>& another)
-        : _ptr(dynamic_cast<T*>(another._ptr)),
+    SharedPtr(const SharedPtr<U, Policy>& another)
+        : _ptr(convert(another._ptr)),
           _control_block(another._control_block) {
         if (_control_block != nullptr) {
-            ++(_control_block->_shared_counter);
+            Policy::increment(_control_block, packed_counters::shared_one);
+        }
+    }
+
+    // aliasing constructor: shares ownership with another, but points to ptr
+    template <typename U>
+    SharedPtr(const SharedPtr<U, Policy>& another, pointer ptr)
+        : _ptr(ptr), _control_block(another._control_block) {
+        if (_control_block != nullptr) {
+            Policy::increment(_control_block, packed_counters::shared_one);
         }
     }
 
+    template <typename U>
+    SharedPtr(SharedPtr<U, Policy>&& another, pointer ptr) noexcept
+        : _ptr(ptr), _control_block(another._control_block) {
+        another._ptr = nullptr;
+        another._control_block = nullptr;
+    }
+
     SharedPtr(SharedPtr&& another) noexcept
         : _ptr(another._ptr), _control_block(another._control_block) {
         another._ptr = nullptr;
@@ -175,20 +728,30 @@ class SharedPtr {
     }
 
     template <typename U>
-    SharedPtr(SharedPtr<U>&& another) noexcept
-        : _ptr(dynamic_cast<T*>(another._ptr)),
+    SharedPtr(SharedPtr<U, Policy>&& another) noexcept
+        : _ptr(convert(another._ptr)),
           _control_block(another._control_block) {
         another._ptr = nullptr;
         another._control_block = nullptr;
     }
 
+    // sharing a block already, only the pointer changes and the counters
+    // are left alone
     SharedPtr& operator=(const SharedPtr& another) {
+        if (_control_block == another._control_block) {
+            _ptr = another._ptr;
+            return *this;
+        }
         SharedPtr(another).swap(*this);
         return *this;
     }
 
     template <typename U>
-    SharedPtr& operator=(const SharedPtr<U>& another) {
+    SharedPtr& operator=(const SharedPtr<U, Policy>& another) {
+        if (_control_block == another._control_block) {
+            _ptr = convert(another._ptr);
+            return *this;
+        }
         SharedPtr(another).swap(*this);
         return *this;
     }
@@ -199,7 +762,7 @@ class SharedPtr {
     }
 
     template <typename U>
-    SharedPtr& operator=(SharedPtr<U>&& another) {
+    SharedPtr& operator=(SharedPtr<U, Policy>&& another) {
         SharedPtr(std::move(another)).swap(*this);
         return *this;
     }
@@ -228,11 +791,23 @@ class SharedPtr {
         return *_ptr;
     }
 
+    reference operator[](std::ptrdiff_t index)
+        requires std::is_array_v<T>
+    {
+        return _ptr[index];
+    }
+
+    const_reference operator[](std::ptrdiff_t index) const
+        requires std::is_array_v<T>
+    {
+        return _ptr[index];
+    }
+
     size_t use_count() const noexcept {
         if (_control_block == nullptr) {
             return 0;
         }
-        return _control_block->_shared_counter;
+        return Policy::use_count(_control_block);
     }
 
     void reset() {
@@ -240,26 +815,51 @@ class SharedPtr {
         swap(copy);
     }
 
-    template <typename U, typename Deleter = std::default_delete<U>,
-              typename Allocator = std::allocator<U>>
+    template <typename U, typename Deleter = default_deleter<U>,
+              typename Allocator = typename default_block_allocator<U>::type>
     void reset(U* ptr, Deleter deleter = Deleter(),
                Allocator allocator = Allocator()) {
+        using block_type = regular_block<U, Deleter, Allocator,
+                                         typename Policy::block_header>;
+        // a sole block of the same type is recycled instead of reallocated
+        if constexpr (!std::is_base_of_v<EnableSharedFromThis<U, Policy>,
+                                         U>) {
+            if (owns_alone(&block_type::operations) &&
+                same_allocator(
+                    static_cast<block_type*>(_control_block)->_allocator,
+                    allocator)) {
+                auto* block = static_cast<block_type*>(_control_block);
+                block_type::destroy_block(block);
+                block->~block_type();
+                ::new (static_cast<void*>(block))
+                    block_type(1, 1, ptr, deleter, allocator);
+                Policy::adopt(block, ptr);
+                _ptr = ptr;
+                return;
+            }
+        }
         auto copy = SharedPtr(ptr, deleter, allocator);
         swap(copy);
     }
 
+    // Replaces the object by one constructed from args. The object of a
+    // block made by allocateShared with Allocator is rebuilt in place, or in
+    // its own allocation if it is placed out of line, when this is its only
+    // reference and Policy is recyclable; otherwise allocateShared makes a
+    // new one.
+    template <typename Allocator = typename default_block_allocator<T>::type,
+              typename... Args>
+    void resetInPlace(Args&&... args)
+        requires(!std::is_array_v<T>);
+
     ~SharedPtr() {
         if (_control_block == nullptr) {
             return;
         }
-        --(_control_block->_shared_counter);
-        if (_control_block->_shared_counter == 0 && _ptr != nullptr) {
-            _control_block->destroy();
-            _ptr = nullptr;
-        }
-        if (_control_block->_shared_counter == 0 &&
-            _control_block->_weak_counter == 0) {
-            _control_block->deallocate();
+        uint64_t left =
+            Policy::decrement(_control_block, packed_counters::shared_one);
+        if (packed_counters::shared(left) == 0) {
+            Policy::expire(_control_block, left);
         }
     }
 
@@ -269,48 +869,264 @@ class SharedPtr {
     }
 
     template <typename U>
-    void swap(SharedPtr<U>& another) {
+    void swap(SharedPtr<U, Policy>& another) {
         SharedPtr copy(another);
         another = *this;
         swap(copy);
     }
 
   private:
+    // a recycled block must still go back to the allocator which made it
+    template <typename Allocator>
+    static bool same_allocator(const Allocator& stored,
+                               const Allocator& given) {
+        if constexpr (std::allocator_traits<
+                          Allocator>::is_always_equal::value) {
+            return true;
+        } else {
+            return stored == given;
+        }
+    }
+
+    // the block has the given type, nobody else can reach it and the policy
+    // would release its object right away
+    bool owns_alone(const block_operations* operations) const noexcept {
+        return Policy::recyclable && _control_block != nullptr &&
+               _control_block->_operations == operations &&
+               Policy::unique(_control_block);
+    }
+
     pointer _ptr = nullptr;
     block_pointer _control_block = nullptr;
 };
 
-template <typename T, typename Allocator = std::allocator<T>, typename... Args>
-SharedPtr<T> allocateShared(const Allocator& allocator = Allocator(),
-                            Args&&... args) {
-    using block_alloc = typename std::allocator_traits<
-        Allocator>::template rebind_alloc<shared_block<T, Allocator>>;
+// Two allocations instead of one: the object is built by Allocator on its
+// own and the control block only points to it, so destroy() frees the
+// object's memory while WeakPtrs keep the block. makeShared takes this path
+// for the types selected by out_of_line_object.
+template <typename T, typename Policy = multi_threaded,
+          typename Allocator = typename default_block_allocator<T>::type,
+          typename... Args>
+SharedPtr<T, Policy> allocateSharedOutOfLine(
+    const Allocator& allocator = Allocator(), Args&&... args) {
+    static_assert(!std::is_array_v<T>, "arrays are kept in their block");
+    using block_type =
+        out_of_line_block<T, Allocator, typename Policy::block_header>;
+    using object_alloc = typename block_type::object_alloc;
+    using block_alloc = typename block_type::block_alloc;
+    constexpr bool overwrite =
+        sizeof...(Args) == 1 &&
+        (std::is_same_v<std::decay_t<Args>, for_overwrite_t> && ...);
+    object_alloc objects = allocator;
+    T* ptr = std::allocator_traits<object_alloc>::allocate(objects, 1);
+    try {
+        if constexpr (overwrite) {
+            ::new (static_cast<void*>(ptr)) T;
+        } else {
+            std::allocator_traits<object_alloc>::construct(
+                objects, ptr, std::forward<Args>(args)...);
+        }
+    } catch (...) {
+        std::allocator_traits<object_alloc>::deallocate(objects, ptr, 1);
+        throw;
+    }
     block_alloc alloc = allocator;
-    shared_block<T, Allocator>* control_block =
-        std::allocator_traits<block_alloc>::allocate(alloc, 1);
-    std::allocator_traits<block_alloc>::construct(
-        alloc, control_block, 1, 0, allocator, std::forward<Args>(args)...);
-    T* ptr = &(control_block->_object);
-    return SharedPtr<T>(0, ptr, static_cast<base_block*>(control_block));
+    block_type* control_block = nullptr;
+    try {
+        control_block = std::allocator_traits<block_alloc>::allocate(alloc, 1);
+    } catch (...) {
+        std::allocator_traits<object_alloc>::destroy(objects, ptr);
+        std::allocator_traits<object_alloc>::deallocate(objects, ptr, 1);
+        throw;
+    }
+    std::allocator_traits<block_alloc>::construct(alloc, control_block, 1, 1,
+                                                  ptr, allocator);
+    Policy::adopt(control_block, ptr);
+    return SharedPtr<T, Policy>(ptr, static_cast<base_block*>(control_block));
+}
+
+template <typename T, typename Policy = multi_threaded, typename... Args>
+SharedPtr<T, Policy> makeSharedOutOfLine(Args&&... args) {
+    using allocator = typename default_block_allocator<T>::type;
+    return allocateSharedOutOfLine<T, Policy>(allocator(),
+                                              std::forward<Args>(args)...);
+}
+
+// For T[] the arguments are the number of elements and optionally a value
+// to copy into each of them; for T[N] only the optional value.
+template <typename T, typename Policy = multi_threaded,
+          typename Allocator =
+              typename default_block_allocator<std::remove_extent_t<T>>::type,
+          typename... Args>
+SharedPtr<T, Policy> allocateShared(const Allocator& allocator = Allocator(),
+                                    Args&&... args) {
+    if constexpr (std::is_array_v<T>) {
+        using element = std::remove_extent_t<T>;
+        using block_type = shared_array_block<element, Allocator,
+                                              typename Policy::block_header>;
+        block_type* control_block = nullptr;
+        if constexpr (std::is_unbounded_array_v<T>) {
+            control_block = block_type::create(allocator, args...);
+        } else {
+            control_block =
+                block_type::create(allocator, std::extent_v<T>, args...);
+        }
+        Policy::adopt(control_block, control_block->elements(),
+                      control_block->_size);
+        return SharedPtr<T, Policy>(control_block->elements(),
+                                    static_cast<base_block*>(control_block));
+    } else if constexpr (out_of_line_object<T>::value) {
+        return allocateSharedOutOfLine<T, Policy, Allocator>(
+            allocator, std::forward<Args>(args)...);
+    } else {
+        using block_type =
+            shared_block<T, Allocator, typename Policy::block_header>;
+        using block_alloc = typename std::allocator_traits<
+            Allocator>::template rebind_alloc<block_type>;
+        block_alloc alloc = allocator;
+        block_type* control_block =
+            std::allocator_traits<block_alloc>::allocate(alloc, 1);
+        std::allocator_traits<block_alloc>::construct(
+            alloc, control_block, 1, 1, allocator,
+            std::forward<Args>(args)...);
+        T* ptr = &(control_block->_object);
+        Policy::adopt(control_block, ptr);
+        return SharedPtr<T, Policy>(ptr,
+                                    static_cast<base_block*>(control_block));
+    }
 };
 
-template <typename T, typename... Args>
-SharedPtr<T> makeShared(Args&&... args) {
-    return allocateShared<T>(std::allocator<T>(), std::forward<Args>(args)...);
+template <typename T, typename Policy = multi_threaded, typename... Args>
+SharedPtr<T, Policy> makeShared(Args&&... args) {
+    using allocator =
+        typename default_block_allocator<std::remove_extent_t<T>>::type;
+    return allocateShared<T, Policy>(allocator(),
+                                     std::forward<Args>(args)...);
 };
 
-template <typename T>
+template <typename T, typename Policy>
+template <typename Allocator, typename... Args>
+void SharedPtr<T, Policy>::resetInPlace(Args&&... args)
+    requires(!std::is_array_v<T>)
+{
+    using header = typename Policy::block_header;
+    if constexpr (out_of_line_object<T>::value) {
+        // the object is rebuilt in its own allocation
+        using block_type = out_of_line_block<T, Allocator, header>;
+        using object_alloc = typename block_type::object_alloc;
+        if (owns_alone(&block_type::operations) &&
+            _ptr == static_cast<block_type*>(_control_block)->_pointer) {
+            auto* block = static_cast<block_type*>(_control_block);
+            object_alloc objects = block->_allocator;
+            std::allocator_traits<object_alloc>::destroy(objects, _ptr);
+            try {
+                std::allocator_traits<object_alloc>::construct(
+                    objects, _ptr, std::forward<Args>(args)...);
+            } catch (...) {
+                std::allocator_traits<object_alloc>::deallocate(objects,
+                                                                _ptr, 1);
+                block->_pointer = nullptr;
+                _ptr = nullptr;
+                _control_block = nullptr;
+                block_type::deallocate_block(block);
+                throw;
+            }
+            return;
+        }
+    } else {
+        using block_type = shared_block<T, Allocator, header>;
+        if (owns_alone(&block_type::operations) &&
+            _ptr == &static_cast<block_type*>(_control_block)->_object) {
+            auto* block = static_cast<block_type*>(_control_block);
+            block_type::destroy_block(block);
+            try {
+                std::allocator_traits<Allocator>::construct(
+                    block->_allocator, &block->_object,
+                    std::forward<Args>(args)...);
+            } catch (...) {
+                // the old object is gone already, so the block goes with it
+                _ptr = nullptr;
+                _control_block = nullptr;
+                block_type::deallocate_block(block);
+                throw;
+            }
+            return;
+        }
+    }
+    *this = allocateShared<T, Policy, Allocator>(Allocator(),
+                                                 std::forward<Args>(args)...);
+}
+
+// Like allocateShared, but the object or the elements are default-initialized,
+// so buffers of trivial types are left uninitialized; the arguments are the
+// number of elements for T[] and nothing otherwise.
+template <typename T, typename Policy = multi_threaded,
+          typename Allocator =
+              typename default_block_allocator<std::remove_extent_t<T>>::type,
+          typename... Args>
+SharedPtr<T, Policy> allocateSharedForOverwrite(
+    const Allocator& allocator = Allocator(), Args&&... args) {
+    static_assert(sizeof...(Args) == (std::is_unbounded_array_v<T> ? 1 : 0),
+                  "only T[] takes an argument, the number of elements");
+    return allocateShared<T, Policy, Allocator>(
+        allocator, std::forward<Args>(args)..., for_overwrite);
+}
+
+template <typename T, typename Policy = multi_threaded, typename... Args>
+SharedPtr<T, Policy> makeSharedForOverwrite(Args&&... args) {
+    using allocator =
+        typename default_block_allocator<std::remove_extent_t<T>>::type;
+    return allocateSharedForOverwrite<T, Policy>(allocator(),
+                                                 std::forward<Args>(args)...);
+}
+
+template <typename T, typename U, typename Policy>
+SharedPtr<T, Policy> staticPointerCast(const SharedPtr<U, Policy>& ptr) {
+    using element = typename SharedPtr<T, Policy>::element_type;
+    using source = typename SharedPtr<U, Policy>::element_type;
+    return SharedPtr<T, Policy>(
+        ptr, static_cast<element*>(const_cast<source*>(ptr.get())));
+}
+
+template <typename T, typename U, typename Policy>
+SharedPtr<T, Policy> dynamicPointerCast(const SharedPtr<U, Policy>& ptr) {
+    using element = typename SharedPtr<T, Policy>::element_type;
+    using source = typename SharedPtr<U, Policy>::element_type;
+    element* result = dynamic_cast<element*>(const_cast<source*>(ptr.get()));
+    if (result == nullptr) {
+        return SharedPtr<T, Policy>();
+    }
+    return SharedPtr<T, Policy>(ptr, result);
+}
+
+template <typename T, typename U, typename Policy>
+SharedPtr<T, Policy> constPointerCast(const SharedPtr<U, Policy>& ptr) {
+    using element = typename SharedPtr<T, Policy>::element_type;
+    return SharedPtr<T, Policy>(ptr, const_cast<element*>(ptr.get()));
+}
+
+template <typename T, typename U, typename Policy>
+SharedPtr<T, Policy> reinterpretPointerCast(const SharedPtr<U, Policy>& ptr) {
+    using element = typename SharedPtr<T, Policy>::element_type;
+    using source = typename SharedPtr<U, Policy>::element_type;
+    return SharedPtr<T, Policy>(
+        ptr, reinterpret_cast<element*>(const_cast<source*>(ptr.get())));
+}
+
+template <typename T, typename Policy>
 class WeakPtr {
   public:
     using type = T;
-    using pointer = T*;
-    using const_pointer = const T*;
-    using reference = T&;
-    using const_reference = const T&;
+    using element_type = std::remove_extent_t<T>;
+    using pointer = element_type*;
+    using const_pointer = const element_type*;
+    using reference = element_type&;
+    using const_reference = const element_type&;
     using block = base_block;
     using block_pointer = base_block*;
+    using threading_policy = Policy;
 
-    template <typename U>
+    template <typename U, typename P>
     friend class WeakPtr;
 
     WeakPtr() : _ptr(nullptr), _control_block(nullptr){};
@@ -318,15 +1134,15 @@ class WeakPtr {
     WeakPtr(const WeakPtr& another)
         : _ptr(another._ptr), _control_block(another._control_block) {
         if (_control_block != nullptr) {
-            ++_control_block->_weak_counter;
+            Policy::increment(_control_block, packed_counters::weak_one);
         }
     }
 
     template <typename U>
-    WeakPtr(const WeakPtr<U>& another)
+    WeakPtr(const WeakPtr<U, Policy>& another)
         : _ptr(another._ptr), _control_block(another._control_block) {
         if (_control_block != nullptr) {
-            ++_control_block->_weak_counter;
+            Policy::increment(_control_block, packed_counters::weak_one);
         }
     }
 
@@ -337,7 +1153,7 @@ class WeakPtr {
     }
 
     template <typename U>
-    WeakPtr(WeakPtr<U>&& another)
+    WeakPtr(WeakPtr<U, Policy>&& another)
         : _ptr(another._ptr), _control_block(another._control_block) {
         another._ptr = nullptr;
         another._control_block = nullptr;
@@ -350,29 +1166,34 @@ class WeakPtr {
     }
 
     template <typename U>
-    WeakPtr& operator=(const WeakPtr<U>& another) {
+    WeakPtr& operator=(const WeakPtr<U, Policy>& another) {
         WeakPtr copy(another);
         swap(copy);
         return *this;
     }
 
     template <typename U>
-    WeakPtr(const SharedPtr<U>& another)
+    WeakPtr(const SharedPtr<U, Policy>& another)
         : _ptr(another._ptr), _control_block(another._control_block) {
         if (_control_block != nullptr) {
-            ++_control_block->_weak_counter;
+            Policy::increment(_control_block, packed_counters::weak_one);
         }
     }
 
-    SharedPtr<T> lock() const noexcept {
-        return SharedPtr<T>(1, _ptr, _control_block);
+    SharedPtr<T, Policy> lock() const noexcept {
+        if (_control_block == nullptr ||
+            !Policy::increment_if_nonzero(_control_block,
+                                          packed_counters::shared_one)) {
+            return SharedPtr<T, Policy>();
+        }
+        return SharedPtr<T, Policy>(_ptr, _control_block);
     }
 
     size_t use_count() const noexcept {
         if (_control_block == nullptr) {
             return 0;
         }
-        return _control_block->_shared_counter;
+        return Policy::use_count(_control_block);
     }
 
     bool expired() const noexcept {
@@ -383,9 +1204,8 @@ class WeakPtr {
         if (_control_block == nullptr) {
             return;
         }
-        --_control_block->_weak_counter;
-        if (_control_block->_shared_counter == 0 &&
-            _control_block->_weak_counter == 0) {
+        if (packed_counters::weak(Policy::decrement(
+                _control_block, packed_counters::weak_one)) == 0) {
             _control_block->deallocate();
         }
     }
@@ -396,7 +1216,7 @@ class WeakPtr {
     }
 
     template <typename U>
-    void swap(WeakPtr<U>& another) {
+    void swap(WeakPtr<U, Policy>& another) {
         WeakPtr copy(another);
         another = *this;
         swap(copy);
@@ -407,20 +1227,20 @@ class WeakPtr {
     block_pointer _control_block = nullptr;
 };
 
-template <typename T>
+template <typename T, typename Policy>
 class EnableSharedFromThis {
   public:
-    SharedPtr<T> shared_from_this() const noexcept {
+    SharedPtr<T, Policy> shared_from_this() const noexcept {
         return _weak_ptr.lock();
     }
 
     template <typename U>
-    void set_pointer(const SharedPtr<U>& ptr) {
+    void set_pointer(const SharedPtr<U, Policy>& ptr) {
         _weak_ptr = ptr;
     }
 
   private:
-    WeakPtr<T> _weak_ptr = WeakPtr<T>();
+    WeakPtr<T, Policy> _weak_ptr = WeakPtr<T, Policy>();
 };
 
 #endif  //SHAREDPTR_SMART_POINTERS_H
\ No newline at end of file
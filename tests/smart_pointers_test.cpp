@@ -1,9 +1,26 @@
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
 #include <iostream>
 #include <memory>
+#include <new>
+#include <stdexcept>
+#include <thread>
 #include <vector>
 
+#include "../src/atomic_shared_ptr.h"
+#include "../src/background_reclaimer.h"
+#include "../src/biased_counting.h"
+#include "../src/compact_shared_ptr.h"
+#include "../src/cycle_collector.h"
+#include "../src/epoch_reclamation.h"
+#include "../src/hazard_pointers.h"
+#include "../src/intrusive_ptr.h"
+#include "../src/local_shared_ptr.h"
+#include "../src/pool_allocator.h"
+#include "../src/rcu_ptr.h"
+#include "../src/refcount_buffer.h"
 #include "../src/smart_pointers.h"
 
 // NOLINTBEGIN
@@ -149,6 +166,8 @@ void test_weak_ptr() {
     }
     assert(weak.use_count() == 0);
     assert(weak.expired());
+    assert(weak.lock().get() == nullptr);
+    assert(weak.use_count() == 0);
 
     weak = sp;
     auto wp = weak;
@@ -257,8 +276,8 @@ int deallocated = 0;
 int allocate_called = 0;
 int deallocate_called = 0;
 
-int new_called = 0;
-int delete_called = 0;
+std::atomic<int> new_called = 0;
+std::atomic<int> delete_called = 0;
 
 int construct_called = 0;
 int destroy_called = 0;
@@ -611,6 +630,1322 @@ void test_custom_deleter() {
     assert(custom_deleter_called == 1);
 }
 
+void test_threading_policies() {
+    {
+        SharedPtr<int, single_threaded> sp(new int(42));
+        WeakPtr<int, single_threaded> wp = sp;
+        auto ssp = sp;
+        assert(sp.use_count() == 2);
+        sp.reset();
+        ssp.reset();
+        assert(wp.expired());
+    }
+
+    {
+        auto sp = makeShared<Accountant, single_threaded>();
+        auto ssp = sp;
+        assert(sp.use_count() == 2);
+    }
+    assert(Accountant::constructed == Accountant::destructed);
+
+    {
+        SharedPtr<Node> shared(new Node(0));
+        WeakPtr<Node> weak = shared;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([shared, weak]() {
+                for (int i = 0; i < 100'000; ++i) {
+                    SharedPtr<Node> copy = shared;
+                    WeakPtr<Node> weak_copy = weak;
+                    assert(copy->value == 0);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        assert(shared.use_count() == 1);
+        shared.reset();
+        assert(weak.expired());
+    }
+
+    for (int i = 0; i < 1'000; ++i) {
+        SharedPtr<Accountant> shared(new Accountant());
+        WeakPtr<Accountant> weak = shared;
+        std::thread locker([weak]() {
+            while (true) {
+                SharedPtr<Accountant> locked = weak.lock();
+                if (locked.get() == nullptr) {
+                    break;
+                }
+                assert(locked.use_count() >= 1);
+            }
+        });
+        shared.reset();
+        locker.join();
+        assert(weak.expired());
+    }
+    assert(Accountant::constructed == Accountant::destructed);
+}
+
+struct Snapshot {
+    static std::atomic<int> alive;
+
+    Snapshot() {
+        ++alive;
+    }
+    ~Snapshot() {
+        --alive;
+    }
+};
+
+std::atomic<int> Snapshot::alive = 0;
+
+void test_atomic_shared_ptr() {
+    static_assert(AtomicSharedPtr<int>::max_readers == 65'535);
+    {
+        AtomicSharedPtr<int> slot;
+        assert(slot.load().get() == nullptr);
+
+        SharedPtr<int> first(new int(1));
+        slot.store(first);
+        assert(first.use_count() == 2);
+        assert(*slot.load() == 1);
+
+        SharedPtr<int> expected;
+        assert(!slot.compare_exchange_strong(expected, SharedPtr<int>()));
+        assert(expected.get() == first.get());
+        assert(slot.compare_exchange_strong(expected, makeShared<int>(2)));
+        assert(*slot.load() == 2);
+        assert(first.use_count() == 2);
+
+        SharedPtr<int> previous = slot.exchange(SharedPtr<int>());
+        assert(*previous == 2);
+        assert(previous.use_count() == 1);
+        assert(slot.load().get() == nullptr);
+    }
+
+    {
+        AtomicSharedPtr<Snapshot> slot(makeShared<Snapshot>());
+        std::atomic<bool> stop = false;
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 4; ++t) {
+            readers.emplace_back([&slot, &stop]() {
+                while (!stop.load()) {
+                    SharedPtr<Snapshot> snapshot = slot.load();
+                    assert(snapshot.get() != nullptr);
+                    assert(snapshot.use_count() >= 1);
+                }
+            });
+        }
+        for (int i = 0; i < 10'000; ++i) {
+            if (i % 2 == 0) {
+                slot.store(makeShared<Snapshot>());
+            } else {
+                SharedPtr<Snapshot> expected = slot.load();
+                slot.compare_exchange_strong(expected,
+                                             makeShared<Snapshot>());
+            }
+        }
+        stop.store(true);
+        for (auto& reader : readers) {
+            reader.join();
+        }
+    }
+    assert(Snapshot::alive == 0);
+
+    // readers of an empty slot while it is filled and emptied again
+    {
+        AtomicSharedPtr<int> slot;
+        std::atomic<bool> stop = false;
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 4; ++t) {
+            readers.emplace_back([&slot, &stop]() {
+                while (!stop.load()) {
+                    SharedPtr<int> value = slot.load();
+                    assert(value.get() == nullptr || *value >= 0);
+                }
+            });
+        }
+        for (int i = 0; i < 20'000; ++i) {
+            slot.store(makeShared<int>(i));
+            slot.store(SharedPtr<int>());
+            SharedPtr<int> expected;
+            assert(slot.compare_exchange_strong(expected,
+                                                makeShared<int>(i)));
+            expected = slot.load();
+            assert(slot.compare_exchange_strong(expected, SharedPtr<int>()));
+        }
+        stop.store(true);
+        for (auto& reader : readers) {
+            reader.join();
+        }
+        assert(slot.load().get() == nullptr);
+    }
+}
+
+void test_block_size() {
+    // stateless deleters and allocators must not add to the block size
+    static_assert(sizeof(regular_block<int>) ==
+                  sizeof(base_block) + sizeof(int*));
+    static_assert(sizeof(regular_block<int, MyDeleter, MyAllocator<int>>) ==
+                  sizeof(base_block) + sizeof(int*));
+    static_assert(sizeof(shared_block<uint64_t>) ==
+                  sizeof(base_block) + sizeof(uint64_t));
+    static_assert(sizeof(shared_block<uint64_t, MyAllocator<uint64_t>>) ==
+                  sizeof(base_block) + sizeof(uint64_t));
+    static_assert(sizeof(base_block) == sizeof(void*) + sizeof(uint64_t));
+}
+
+struct Pooled {
+    int value = 0;
+};
+
+template <>
+struct default_block_allocator<Pooled> {
+    using type = pool_allocator<Pooled>;
+};
+
+void test_pool_allocator() {
+    // the thread cache itself lives as long as the program
+    local_pool_cache();
+    new_called = 0;
+    delete_called = 0;
+
+    {
+        std::vector<SharedPtr<int>> ptrs;
+        for (int i = 0; i < 10'000; ++i) {
+            ptrs.push_back(SharedPtr<int>(
+                new int(i), std::default_delete<int>(), pool_allocator<int>()));
+            ptrs.push_back(makePooled<int>(i));
+        }
+        for (int i = 0; i < 10'000; ++i) {
+            assert(*ptrs[2 * i] == i);
+            assert(*ptrs[2 * i + 1] == i);
+        }
+        // only the objects themselves and the vector went through new
+        assert(new_called < 10'000 + 100);
+    }
+    assert(new_called == delete_called);
+
+    {
+        auto sp = makeShared<Pooled>();
+        SharedPtr<Pooled> ssp(new Pooled());
+        assert(sp->value == 0 && ssp->value == 0);
+        assert(pool_cache::slab_of(sp.get())->_owner == local_pool_cache());
+    }
+
+    // blocks die on a thread other than the one which allocated them
+    {
+        std::vector<SharedPtr<Snapshot>> ptrs;
+        std::thread producer([&ptrs]() {
+            for (int i = 0; i < 10'000; ++i) {
+                ptrs.push_back(makePooled<Snapshot>());
+            }
+        });
+        producer.join();
+        std::thread consumer([&ptrs]() {
+            ptrs.clear();
+            for (int i = 0; i < 10'000; ++i) {
+                ptrs.push_back(makePooled<Snapshot>());
+            }
+        });
+        consumer.join();
+        ptrs.clear();
+    }
+    assert(Snapshot::alive == 0);
+}
+
+using deferred = deferred_release<multi_threaded>;
+
+struct Link {
+    using Ptr = SharedPtr<Link, deferred>;
+
+    static int destructed;
+
+    Ptr next;
+    WeakPtr<Link, deferred> prev;
+
+    ~Link() {
+        ++destructed;
+    }
+};
+
+int Link::destructed = 0;
+
+void test_deferred_release() {
+    // recursive destruction of such a list would overflow the stack
+    const int length = 1'000'000;
+    {
+        Link::Ptr head(new Link());
+        for (int i = 1; i < length; ++i) {
+            Link::Ptr node = i % 2 == 0 ? Link::Ptr(new Link())
+                                        : makeShared<Link, deferred>();
+            head->prev = node;
+            node->next = std::move(head);
+            head = std::move(node);
+        }
+        WeakPtr<Link, deferred> observer = head;
+        head.reset();
+        assert(observer.expired());
+        assert(Link::destructed == length);
+    }
+    assert(Link::destructed == length);
+}
+
+void test_background_release() {
+    using background = background_release<multi_threaded>;
+    BackgroundReclaimer& reclaimer = BackgroundReclaimer::instance();
+    reclaimer.configure(16, 1'000);
+
+    {
+        auto sp = makeShared<Snapshot, background>();
+        WeakPtr<Snapshot, background> wp = sp;
+        SharedPtr<Snapshot, background> ssp(new Snapshot());
+        sp.reset();
+        ssp.reset();
+        // expired at once, destroyed later
+        assert(wp.expired());
+        assert(wp.lock().get() == nullptr);
+        assert(Snapshot::alive == 2);
+        assert(reclaimer.pending() == 2);
+        assert(reclaimer.drain() == 2);
+        assert(Snapshot::alive == 0);
+    }
+
+    // the queue never grows beyond its limit
+    {
+        std::vector<SharedPtr<Snapshot, background>> ptrs;
+        for (int i = 0; i < 10'000; ++i) {
+            ptrs.push_back(makeShared<Snapshot, background>());
+        }
+        ptrs.clear();
+        assert(reclaimer.pending() <= 1'000);
+        reclaimer.drain();
+        assert(Snapshot::alive == 0);
+    }
+
+    reclaimer.start();
+    {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([]() {
+                for (int i = 0; i < 10'000; ++i) {
+                    auto sp = makeShared<Snapshot, background>();
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    reclaimer.stop();
+    assert(reclaimer.pending() == 0);
+    assert(Snapshot::alive == 0);
+}
+
+void test_biased_counting() {
+    using BiasedPtr = SharedPtr<Snapshot, biased>;
+    {
+        BiasedPtr sp = makeShared<Snapshot, biased>();
+        BiasedPtr copy = sp;
+        WeakPtr<Snapshot, biased> weak = sp;
+        assert(sp.use_count() == 2);
+        assert(weak.lock().use_count() == 3);
+        copy.reset();
+        assert(sp.use_count() == 1);
+        sp.reset();
+        assert(weak.expired());
+        assert(Snapshot::alive == 0);
+    }
+    // references counted by the owner are dropped on other threads
+    {
+        BiasedPtr sp = makeShared<Snapshot, biased>();
+        std::vector<BiasedPtr> copies(4, sp);
+        std::vector<std::thread> threads;
+        for (auto& copy : copies) {
+            threads.emplace_back([moved = std::move(copy)]() mutable {
+                for (int i = 0; i < 10'000; ++i) {
+                    BiasedPtr again = moved;
+                }
+                moved.reset();
+            });
+        }
+        for (int i = 0; i < 10'000; ++i) {
+            BiasedPtr again = sp;
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        assert(sp.use_count() == 1);
+        assert(Snapshot::alive == 1);
+        sp.reset();
+        assert(Snapshot::alive == 0);
+    }
+    // the owner exits while its references are still in use
+    {
+        BiasedPtr escaped;
+        WeakPtr<Snapshot, biased> weak;
+        std::thread([&]() {
+            escaped = makeShared<Snapshot, biased>();
+            weak = escaped;
+        }).join();
+        BiasedPtr copy = weak.lock();
+        assert(copy.get() != nullptr);
+        assert(escaped.use_count() == 2);
+        escaped.reset();
+        copy.reset();
+        assert(weak.expired());
+        assert(Snapshot::alive == 0);
+    }
+    // array blocks are biased towards their creator as well
+    {
+        auto numbers = makeShared<Snapshot[], biased>(3);
+        std::thread([copy = numbers]() mutable {
+            copy.reset();
+        }).join();
+        assert(numbers.use_count() == 1);
+        numbers.reset();
+        assert(Snapshot::alive == 0);
+    }
+}
+
+void test_pointer_casts() {
+    mother_created = 0;
+    mother_destroyed = 0;
+    son_created = 0;
+    son_destroyed = 0;
+
+    {
+        SharedPtr<Son> son(new Son());
+        SharedPtr<Mother> mother = son;
+        assert(mother.get() == son.get());
+        assert(son.use_count() == 2);
+
+        auto back = staticPointerCast<Son>(mother);
+        assert(back.get() == son.get());
+        assert(son.use_count() == 3);
+
+        auto checked = dynamicPointerCast<Son>(mother);
+        assert(checked.get() == son.get());
+        assert(son.use_count() == 4);
+
+        SharedPtr<Mother> only_mother(new Mother());
+        auto failed = dynamicPointerCast<Son>(only_mother);
+        assert(failed.get() == nullptr);
+        assert(failed.use_count() == 0);
+        assert(only_mother.use_count() == 1);
+
+        SharedPtr<const Son> const_son = son;
+        auto mutable_son = constPointerCast<Son>(const_son);
+        assert(mutable_son.get() == son.get());
+
+        auto raw = reinterpretPointerCast<char>(son);
+        assert(static_cast<void*>(raw.get()) == static_cast<void*>(son.get()));
+        assert(son.use_count() == 7);
+    }
+    assert(son_created == son_destroyed);
+    assert(mother_created == mother_destroyed);
+
+    // aliasing constructor
+    {
+        struct Pair {
+            int first = 1;
+            int second = 2;
+        };
+        auto pair = makeShared<Pair>();
+        SharedPtr<int> second(pair, &pair->second);
+        assert(*second == 2);
+        assert(pair.use_count() == 2);
+        pair.reset();
+        assert(second.use_count() == 1);
+        assert(*second == 2);
+
+        SharedPtr<int> moved(std::move(second), second.get());
+        assert(second.get() == nullptr);
+        assert(moved.use_count() == 1);
+    }
+}
+
+using buffered_mt = buffered<multi_threaded>;
+
+struct Chain {
+    using Ptr = SharedPtr<Chain, buffered_mt>;
+
+    Snapshot snapshot;
+    Ptr next;
+};
+
+void test_refcount_buffer() {
+    {
+        auto sp = makeShared<Snapshot, buffered_mt>();
+        WeakPtr<Snapshot, buffered_mt> weak = sp;
+        {
+            RefcountBuffer buffer;
+            for (int i = 0; i < 1'000; ++i) {
+                SharedPtr<Snapshot, buffered_mt> copy = sp;
+            }
+            // the buffer holds one reference, whatever the number of copies
+            assert(sp.use_count() == 2);
+            assert(weak.lock().get() == sp.get());
+            sp.reset();
+            // destruction waits for the flush
+            assert(Snapshot::alive == 1);
+        }
+        assert(weak.expired());
+        assert(Snapshot::alive == 0);
+    }
+    // the releases while walking a chain wait for the end of the scope
+    {
+        Chain::Ptr head;
+        for (int i = 0; i < 100; ++i) {
+            auto node = makeShared<Chain, buffered_mt>();
+            node->next = std::move(head);
+            head = std::move(node);
+        }
+        {
+            RefcountBuffer buffer;
+            int length = 0;
+            for (Chain::Ptr node = head; node.get() != nullptr;
+                 node = node->next) {
+                ++length;
+            }
+            assert(length == 100);
+            // more blocks than the buffer holds: the oldest were flushed
+            assert(head.use_count() == 1);
+            RefcountBuffer inner;
+            head.reset();
+            assert(Snapshot::alive == 100);
+        }
+        assert(Snapshot::alive == 0);
+    }
+    // a reference dropped on another thread is counted at once
+    {
+        auto sp = makeShared<Snapshot, buffered_mt>();
+        RefcountBuffer buffer;
+        auto copy = sp;
+        std::thread([moved = std::move(sp)]() mutable {
+            moved.reset();
+        }).join();
+        copy.reset();
+        assert(Snapshot::alive == 1);
+        buffer.flush();
+        assert(Snapshot::alive == 0);
+    }
+    // copies made inside the scope may be released on another thread
+    {
+        auto sp = makeShared<Snapshot, buffered_mt>();
+        RefcountBuffer buffer;
+        {
+            auto released = sp;
+        }
+        auto first = sp;
+        auto second = sp;
+        std::thread([first = std::move(first),
+                     second = std::move(second)]() mutable {
+            first.reset();
+            second.reset();
+        }).join();
+        assert(Snapshot::alive == 1);
+        assert(sp.use_count() == 1);
+        auto copy = sp;
+        assert(copy.get() == sp.get());
+    }
+    assert(Snapshot::alive == 0);
+}
+
+struct Counted : IntrusiveRefCounted<Counted> {
+    Snapshot snapshot;
+    int value = 0;
+
+    explicit Counted(int value) : value(value) {}
+    virtual ~Counted() = default;
+
+    IntrusivePtr<Counted> self() {
+        return IntrusivePtr<Counted>(this);
+    }
+};
+
+struct CountedChild : Counted {
+    CountedChild() : Counted(1) {}
+};
+
+struct LocalCounted : IntrusiveRefCounted<LocalCounted, single_threaded> {
+    Snapshot snapshot;
+};
+
+void test_intrusive_ptr() {
+    static_assert(sizeof(IntrusivePtr<Counted>) == sizeof(void*));
+    {
+        IntrusivePtr<Counted> sp = makeIntrusive<Counted>(5);
+        IntrusivePtr<Counted> copy = sp;
+        assert(sp.use_count() == 2);
+        // the count travels with the object
+        IntrusivePtr<Counted> again = sp->self();
+        assert(again.use_count() == 3);
+        copy.reset();
+        again = std::move(copy);
+        assert(sp.use_count() == 1);
+        assert(sp->value == 5);
+        IntrusivePtr<Counted> child = makeIntrusive<CountedChild>();
+        assert(child->value == 1);
+        assert(Snapshot::alive == 2);
+        child = sp;
+        assert(Snapshot::alive == 1);
+        assert(sp.use_count() == 2);
+    }
+    assert(Snapshot::alive == 0);
+    // weak references move the count to a side block
+    {
+        IntrusiveWeakPtr<Counted> weak;
+        {
+            IntrusivePtr<Counted> sp = makeIntrusive<Counted>(7);
+            IntrusivePtr<Counted> copy = sp;
+            weak = IntrusiveWeakPtr<Counted>(sp);
+            assert(sp.use_count() == 2);
+            assert(weak.use_count() == 2);
+            IntrusivePtr<Counted> locked = weak.lock();
+            assert(locked.get() == sp.get());
+            assert(sp.use_count() == 3);
+            IntrusiveWeakPtr<Counted> second(copy);
+            assert(second.lock()->value == 7);
+        }
+        assert(weak.expired());
+        assert(weak.lock().get() == nullptr);
+        assert(Snapshot::alive == 0);
+    }
+    {
+        IntrusivePtr<LocalCounted> sp = makeIntrusive<LocalCounted>();
+        IntrusiveWeakPtr<LocalCounted> weak(sp);
+        assert(weak.lock().use_count() == 2);
+        sp.reset();
+        assert(weak.expired());
+        assert(Snapshot::alive == 0);
+    }
+    // copies racing with the move to the side block
+    {
+        IntrusivePtr<Counted> sp = makeIntrusive<Counted>(0);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([sp]() {
+                for (int i = 0; i < 1'000; ++i) {
+                    IntrusivePtr<Counted> copy = sp;
+                    IntrusiveWeakPtr<Counted> weak(copy);
+                    assert(weak.lock().get() == sp.get());
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        assert(sp.use_count() == 1);
+    }
+    assert(Snapshot::alive == 0);
+}
+
+void test_compact_shared_ptr() {
+    static_assert(sizeof(CompactSharedPtr<int>) == sizeof(void*));
+    {
+        auto sp = makeCompact<NeitherDefaultNorCopyConstructible>(3);
+        assert(sp->x == 3);
+        auto copy = sp;
+        assert(sp.use_count() == 2);
+        SharedPtr<NeitherDefaultNorCopyConstructible> shared = copy.share();
+        assert(shared.get() == sp.get());
+        WeakPtr<NeitherDefaultNorCopyConstructible> weak = shared;
+        assert(weak.use_count() == 3);
+        copy.reset();
+        assert(copy.get() == nullptr);
+        shared.reset();
+        assert(sp.use_count() == 1);
+        sp = std::move(copy);
+        assert(weak.expired());
+    }
+    // the offset of the object follows the policy's block header
+    {
+        auto sp = makeCompact<Snapshot, biased>();
+        std::vector<CompactSharedPtr<Snapshot, biased>> many(1'000, sp);
+        assert(sp.use_count() == 1'001);
+        assert(many.back().get() == sp.share().get());
+        many.clear();
+        sp.reset();
+        assert(Snapshot::alive == 0);
+    }
+    {
+        auto sp = allocateCompact<int, single_threaded>(pool_allocator<int>(),
+                                                        42);
+        assert(*sp == 42);
+        assert(*sp.share() == 42);
+    }
+}
+
+void test_arrays() {
+    Accountant::constructed = 0;
+    Accountant::destructed = 0;
+    {
+        SharedPtr<Accountant[]> sp(new Accountant[3]);
+        auto copy = sp;
+        assert(&copy[2] == sp.get() + 2);
+    }
+    assert(Accountant::constructed == 3);
+    assert(Accountant::destructed == 3);
+    {
+        SharedPtr<Accountant[2]> sp(new Accountant[2]);
+        assert(&sp[1] == sp.get() + 1);
+        SharedPtr<int[5]> numbers(new int[5]{1, 2, 3, 4, 5});
+        numbers[4] = 6;
+        assert(numbers[0] == 1 && numbers[4] == 6);
+    }
+    assert(Accountant::constructed == 5);
+    assert(Accountant::destructed == 5);
+    {
+        new_called = 0;
+        SharedPtr<int[]> sp = makeShared<int[]>(100);
+        // the block and the elements come from one allocation
+        assert(new_called == 1);
+        assert(sp[0] == 0 && sp[99] == 0);
+        sp[42] = 42;
+        const SharedPtr<int[]>& view = sp;
+        assert(view[42] == 42);
+        auto filled = makeShared<uint64_t[]>(3, 7);
+        assert(filled[0] == 7 && filled[2] == 7);
+        auto empty = makeShared<double[]>(0);
+        assert(empty.get() != nullptr && empty.use_count() == 1);
+    }
+    {
+        auto sp = makeShared<Snapshot[4]>();
+        WeakPtr<Snapshot[4]> weak = sp;
+        assert(Snapshot::alive == 4);
+        SharedPtr<const Snapshot[4]> constant = sp;
+        sp.reset();
+        assert(weak.lock().get() == constant.get());
+        constant.reset();
+        assert(weak.expired());
+        assert(Snapshot::alive == 0);
+    }
+    {
+        auto sp = allocateShared<Snapshot[]>(pool_allocator<Snapshot>(), 5);
+        assert(Snapshot::alive == 5);
+        auto pair = allocateShared<int[2], single_threaded>(
+            std::allocator<int>(), 5);
+        assert(pair[0] == 5 && pair[1] == 5);
+    }
+    // sizes whose storage does not fit into size_t
+    {
+        bool thrown = false;
+        try {
+            makeShared<uint64_t[]>(SIZE_MAX / 8 + 2);
+        } catch (const std::bad_array_new_length&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+}
+
+void test_for_overwrite() {
+    {
+        auto buffer = makeSharedForOverwrite<std::array<char, 1 << 16>>();
+        buffer->fill('x');
+        assert((*buffer)[100] == 'x');
+        auto bytes = makeSharedForOverwrite<unsigned char[]>(1 << 20);
+        bytes[(1 << 20) - 1] = 1;
+        assert(bytes[(1 << 20) - 1] == 1);
+        auto fixed = allocateSharedForOverwrite<int[8], single_threaded>(
+            pool_allocator<int>());
+        fixed[7] = 7;
+        assert(fixed[7] == 7);
+    }
+    // class types are still constructed and destroyed
+    Accountant::constructed = 0;
+    Accountant::destructed = 0;
+    {
+        auto one = makeSharedForOverwrite<Accountant>();
+        auto many = makeSharedForOverwrite<Snapshot[]>(3);
+        assert(Accountant::constructed == 1);
+        assert(Snapshot::alive == 3);
+    }
+    assert(Accountant::destructed == 1);
+    assert(Snapshot::alive == 0);
+}
+
+struct Large {
+    Snapshot snapshot;
+    char payload[out_of_line_threshold];
+};
+
+struct LargeInline {
+    char payload[out_of_line_threshold];
+};
+
+template <>
+struct out_of_line_object<LargeInline> : std::false_type {};
+
+void test_out_of_line() {
+    static_assert(out_of_line_object<Large>::value);
+    static_assert(!out_of_line_object<Snapshot>::value);
+    // the block of an out-of-line object only adds a pointer
+    static_assert(sizeof(out_of_line_block<Large>) ==
+                  sizeof(base_block) + sizeof(Large*));
+
+    new_called = 0;
+    delete_called = 0;
+    {
+        auto large = makeShared<Large>();
+        WeakPtr<Large> observer(large);
+        assert(new_called == 2);
+        assert(Snapshot::alive == 1);
+        large.reset();
+        // the object's memory is gone, only the block waits for the WeakPtr
+        assert(Snapshot::alive == 0);
+        assert(delete_called == 1);
+        assert(observer.expired());
+    }
+    assert(delete_called == 2);
+
+    // chosen per call, with any policy and allocator
+    {
+        auto small = makeSharedOutOfLine<Snapshot, single_threaded>();
+        auto pooled = allocateSharedOutOfLine<int>(pool_allocator<int>(), 5);
+        WeakPtr<Snapshot, single_threaded> observer(small);
+        assert(*pooled == 5);
+        small.reset();
+        assert(Snapshot::alive == 0);
+        assert(observer.expired());
+    }
+
+    // a specialization keeps a large type in its block
+    new_called = 0;
+    {
+        auto buffer = makeSharedForOverwrite<LargeInline>();
+        buffer->payload[0] = 1;
+        assert(new_called == 1);
+        auto large = makeSharedForOverwrite<Large>();
+        assert(new_called == 3);
+        assert(Snapshot::alive == 1);
+    }
+    assert(Snapshot::alive == 0);
+}
+
+struct Rebuilt {
+    static bool fail;
+
+    explicit Rebuilt(int value) : value(value) {
+        if (fail) {
+            throw std::runtime_error("Rebuilt");
+        }
+    }
+
+    int value;
+};
+
+bool Rebuilt::fail = false;
+
+struct LargeRebuilt {
+    explicit LargeRebuilt(int value) : rebuilt(value) {}
+
+    Rebuilt rebuilt;
+    char payload[out_of_line_threshold];
+};
+
+// blocks allocated from each of two pools
+int tagged_blocks[2] = {};
+
+template <typename T>
+struct TaggedAllocator {
+    using value_type = T;
+
+    explicit TaggedAllocator(int tag) : tag(tag) {}
+
+    template <typename U>
+    TaggedAllocator(const TaggedAllocator<U>& another) : tag(another.tag) {}
+
+    T* allocate(size_t n) {
+        ++tagged_blocks[tag];
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T* p, size_t n) {
+        --tagged_blocks[tag];
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    bool operator==(const TaggedAllocator& another) const {
+        return tag == another.tag;
+    }
+
+    int tag;
+};
+
+void test_block_reuse() {
+    // reset() recycles a sole block of the same type
+    {
+        SharedPtr<int> ptr(new int(1));
+        new_called = 0;
+        delete_called = 0;
+        ptr.reset(new int(2));
+        assert(*ptr == 2);
+        assert(new_called == 1);
+        assert(delete_called == 1);
+
+        // not while a WeakPtr observes it
+        WeakPtr<int> observer(ptr);
+        new_called = 0;
+        ptr.reset(new int(3));
+        assert(new_called == 2);
+        assert(observer.expired());
+    }
+
+    // only with an allocator which can free the block
+    {
+        using deleter = std::default_delete<int>;
+        SharedPtr<int> ptr(new int(1), deleter(), TaggedAllocator<int>(0));
+        new_called = 0;
+        ptr.reset(new int(2), deleter(), TaggedAllocator<int>(0));
+        assert(new_called == 1);
+        ptr.reset(new int(3), deleter(), TaggedAllocator<int>(1));
+        assert(tagged_blocks[0] == 0);
+        assert(tagged_blocks[1] == 1);
+    }
+    assert(tagged_blocks[1] == 0);
+
+    // resetInPlace() rebuilds the object inside its block
+    {
+        auto ptr = makeShared<Rebuilt>(1);
+        Rebuilt* object = ptr.get();
+        new_called = 0;
+        ptr.resetInPlace(2);
+        assert(ptr.get() == object);
+        assert(ptr->value == 2);
+        assert(new_called == 0);
+
+        auto copy = ptr;
+        ptr.resetInPlace(3);
+        assert(ptr.get() != object);
+        assert(copy->value == 2);
+        assert(ptr->value == 3);
+
+        // a failed construction leaves the pointer empty
+        Rebuilt::fail = true;
+        try {
+            ptr.resetInPlace(4);
+            assert(false);
+        } catch (const std::runtime_error&) {
+        }
+        Rebuilt::fail = false;
+        assert(ptr.get() == nullptr);
+        assert(copy->value == 2);
+
+        SharedPtr<Rebuilt> empty;
+        empty.resetInPlace(5);
+        assert(empty->value == 5);
+    }
+
+    // objects placed out of line are rebuilt in their own allocation
+    {
+        auto ptr = makeShared<LargeRebuilt>(1);
+        LargeRebuilt* object = ptr.get();
+        new_called = 0;
+        ptr.resetInPlace(2);
+        assert(ptr.get() == object);
+        assert(ptr->rebuilt.value == 2);
+        assert(new_called == 0);
+
+        Rebuilt::fail = true;
+        try {
+            ptr.resetInPlace(3);
+            assert(false);
+        } catch (const std::runtime_error&) {
+        }
+        Rebuilt::fail = false;
+        assert(ptr.get() == nullptr);
+    }
+
+    // assignment within one block leaves the counters alone
+    {
+        auto ptr = makeShared<std::pair<int, int>>(1, 2);
+        SharedPtr<int> second(ptr, &ptr->second);
+        SharedPtr<int> first(ptr, &ptr->first);
+        first = second;
+        assert(*first == 2);
+        assert(ptr.use_count() == 3);
+    }
+
+    // policies which defer releases keep deferring the old object
+    {
+        using background = background_release<multi_threaded>;
+        BackgroundReclaimer& reclaimer = BackgroundReclaimer::instance();
+        SharedPtr<Snapshot, background> ptr(new Snapshot());
+        ptr.reset(new Snapshot());
+        assert(reclaimer.pending() == 1);
+        assert(Snapshot::alive == 2);
+        auto made = makeShared<Snapshot, background>();
+        made.resetInPlace();
+        assert(reclaimer.pending() == 2);
+        reclaimer.drain();
+        assert(Snapshot::alive == 2);
+    }
+    BackgroundReclaimer::instance().drain();
+    {
+        using epoch = epoch_release<multi_threaded>;
+        EpochSlot<Snapshot> slot(SharedPtr<Snapshot, epoch>(new Snapshot()));
+        {
+            EpochGuard guard;
+            Snapshot* seen = slot.get();
+            auto old = slot.exchange(makeShared<Snapshot, epoch>());
+            old.reset(new Snapshot());
+            old.resetInPlace();
+            // the reader's object outlives both resets
+            assert(seen != nullptr);
+            assert(Snapshot::alive == 4);
+        }
+        EpochDomain::instance().synchronize();
+        assert(Snapshot::alive == 1);
+    }
+    EpochDomain::instance().synchronize();
+    assert(Snapshot::alive == 0);
+
+    // biased blocks are never recycled, but still reset correctly
+    {
+        auto ptr = makeShared<Rebuilt, biased>(1);
+        ptr.resetInPlace(2);
+        assert(ptr->value == 2);
+    }
+}
+
+struct Entry {
+    explicit Entry(int key) : key(key), square(key * key) {}
+
+    Snapshot snapshot;
+    int key;
+    int square;
+};
+
+void test_hazard_pointers() {
+    HazardDomain& domain = HazardDomain::instance();
+    domain.scan();
+    {
+        HazardSlot<Entry> slot(makeShared<Entry>(2));
+        {
+            auto guard = slot.read();
+            assert(guard->square == 4);
+            // reading takes no reference
+            assert(guard.share().use_count() == 2);
+            slot.store(makeShared<Entry>(3));
+            domain.scan();
+            assert(Snapshot::alive == 2);
+            assert(guard->square == 4);
+            assert(slot.read()->square == 9);
+        }
+        domain.scan();
+        assert(Snapshot::alive == 1);
+
+        SharedPtr<Entry> kept = slot.exchange(SharedPtr<Entry>());
+        assert(!slot.read());
+        assert(slot.load().get() == nullptr);
+        domain.scan();
+        assert(kept->key == 3);
+    }
+    domain.scan();
+    assert(Snapshot::alive == 0);
+
+    // readers always find a consistent entry while writers replace it
+    {
+        HazardSlot<Entry> table[4];
+        for (int i = 0; i < 4; ++i) {
+            table[i].store(makeShared<Entry>(i));
+        }
+        std::atomic<bool> done = false;
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 4; ++t) {
+            readers.emplace_back([&]() {
+                while (!done.load(std::memory_order_relaxed)) {
+                    for (auto& slot : table) {
+                        auto guard = slot.read();
+                        assert(guard->square == guard->key * guard->key);
+                    }
+                }
+            });
+        }
+        for (int i = 0; i < 5'000; ++i) {
+            table[i % 4].store(makeShared<Entry>(i));
+        }
+        done = true;
+        for (auto& reader : readers) {
+            reader.join();
+        }
+    }
+    domain.scan();
+    assert(Snapshot::alive == 0);
+}
+
+void test_epoch_reclamation() {
+    using epoch_mt = epoch_release<multi_threaded>;
+    EpochDomain& domain = EpochDomain::instance();
+    {
+        EpochSlot<Entry> slot(makeShared<Entry, epoch_mt>(2));
+        WeakPtr<Entry, epoch_mt> observer = slot.load();
+        {
+            EpochGuard guard;
+            Entry* entry = slot.get();
+            slot.store(makeShared<Entry, epoch_mt>(3));
+            domain.collect();
+            {
+                EpochGuard nested;
+                domain.collect();
+            }
+            // released, but kept for the reader section
+            assert(observer.expired());
+            assert(Snapshot::alive == 2);
+            assert(entry->square == 4);
+            assert(slot.get()->square == 9);
+        }
+        domain.collect();
+        assert(Snapshot::alive == 1);
+        assert(slot.load()->key == 3);
+    }
+    domain.collect();
+    assert(Snapshot::alive == 0);
+
+    // readers always find a consistent entry while writers replace it
+    {
+        EpochSlot<Entry> table[4];
+        for (int i = 0; i < 4; ++i) {
+            table[i].store(makeShared<Entry, epoch_mt>(i));
+        }
+        std::atomic<bool> done = false;
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 4; ++t) {
+            readers.emplace_back([&]() {
+                while (!done.load(std::memory_order_relaxed)) {
+                    EpochGuard guard;
+                    for (auto& slot : table) {
+                        Entry* entry = slot.get();
+                        assert(entry->square == entry->key * entry->key);
+                    }
+                }
+            });
+        }
+        for (int i = 0; i < 5'000; ++i) {
+            table[i % 4].store(makeShared<Entry, epoch_mt>(i));
+        }
+        done = true;
+        for (auto& reader : readers) {
+            reader.join();
+        }
+    }
+    domain.collect();
+    assert(Snapshot::alive == 0);
+}
+
+void test_rcu_ptr() {
+    {
+        RcuPtr<Entry> index(makeShared<Entry>(2));
+        SharedPtr<Entry> kept = index.load();
+        {
+            auto borrowed = index.read();
+            index.publish(makeShared<Entry>(3));
+            assert(borrowed->square == 4);
+            assert(index.read()->square == 9);
+            // the slot's reference to the old object still waits
+            assert(kept.use_count() == 2);
+        }
+        RcuPtr<Entry>::synchronize();
+        assert(kept.use_count() == 1);
+        assert(kept->key == 2);
+        kept.reset();
+        assert(Snapshot::alive == 1);
+
+        index.publish(SharedPtr<Entry>());
+        assert(!index.read());
+        RcuPtr<Entry>::synchronize();
+        assert(Snapshot::alive == 0);
+    }
+
+    // readers always find a consistent index while the writer replaces it
+    {
+        RcuPtr<Entry> index(makeShared<Entry>(0));
+        std::atomic<bool> done = false;
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 4; ++t) {
+            readers.emplace_back([&]() {
+                while (!done.load(std::memory_order_relaxed)) {
+                    auto borrowed = index.read();
+                    assert(borrowed->square == borrowed->key * borrowed->key);
+                }
+            });
+        }
+        for (int i = 1; i < 2'000; ++i) {
+            index.publish(makeShared<Entry>(i));
+        }
+        done = true;
+        for (auto& reader : readers) {
+            reader.join();
+        }
+    }
+    RcuPtr<Entry>::synchronize();
+    assert(Snapshot::alive == 0);
+}
+
+struct Plugin {
+    void trace(CycleTracer& tracer) const {
+        tracer(peer);
+        for (const auto& dependency : dependencies) {
+            tracer(dependency);
+        }
+    }
+
+    Snapshot snapshot;
+    SharedPtr<Plugin, cycle_collected> peer;
+    std::vector<SharedPtr<Plugin, cycle_collected>> dependencies;
+    SharedPtr<Snapshot, cycle_collected> leaf;
+};
+
+void test_cycle_collector() {
+    using PluginPtr = SharedPtr<Plugin, cycle_collected>;
+    CycleCollector& collector = *CycleCollector::local();
+    collector.collect();
+    {
+        PluginPtr first = makeShared<Plugin, cycle_collected>();
+        PluginPtr second(new Plugin());
+        first->peer = second;
+        second->peer = first;
+        first->leaf = makeShared<Snapshot, cycle_collected>();
+        WeakPtr<Plugin, cycle_collected> observer(first);
+
+        // externally referenced cycles survive
+        second.reset();
+        assert(collector.collect() == 0);
+        assert(Snapshot::alive == 3);
+        assert(first->peer->peer.get() == first.get());
+
+        first.reset();
+        assert(Snapshot::alive == 3);
+        assert(collector.collect() == 2);
+        assert(Snapshot::alive == 0);
+        assert(observer.expired());
+
+        // a self-reference
+        PluginPtr self = makeShared<Plugin, cycle_collected>();
+        self->dependencies.push_back(self);
+        self.reset();
+        assert(collector.collect() == 1);
+        assert(Snapshot::alive == 0);
+    }
+
+    // arrays are traced element by element
+    {
+        auto plugins = makeShared<Plugin[], cycle_collected>(3);
+        plugins[2].peer = PluginPtr(plugins, &plugins[0]);
+        plugins.reset();
+        assert(Snapshot::alive == 3);
+        assert(collector.collect() == 1);
+        assert(Snapshot::alive == 0);
+    }
+
+    // a long ring is collected without deep recursion
+    {
+        PluginPtr head = makeShared<Plugin, cycle_collected>();
+        PluginPtr tail = head;
+        for (int i = 0; i < 100'000; ++i) {
+            tail->peer = makeShared<Plugin, cycle_collected>();
+            tail = tail->peer;
+        }
+        tail->peer = head;
+        tail.reset();
+        head.reset();
+        assert(collector.collect() == 100'001);
+        assert(Snapshot::alive == 0);
+    }
+
+    // collections start on their own once enough candidates are buffered
+    collector.set_threshold(16);
+    for (int i = 0; i < 1'000; ++i) {
+        PluginPtr first = makeShared<Plugin, cycle_collected>();
+        first->peer = makeShared<Plugin, cycle_collected>();
+        first->peer->peer = first;
+    }
+    assert(Snapshot::alive < 2 * 16);
+    assert(collector.candidates() < 16);
+    collector.collect();
+    assert(Snapshot::alive == 0);
+    collector.set_threshold(CycleCollector::default_threshold);
+}
+
+void test_local_shared_ptr() {
+    using Local = LocalSharedPtr<int>;
+    static_assert(!std::is_convertible_v<Local, SharedPtr<int>>);
+    static_assert(!std::is_constructible_v<SharedPtr<int>, Local>);
+    static_assert(!std::is_convertible_v<SharedPtr<int>, Local>);
+    static_assert(sizeof(Local) == sizeof(SharedPtr<int>));
+
+    {
+        LocalSharedPtr<Snapshot> first = makeLocalShared<Snapshot>();
+        LocalSharedPtr<Snapshot> second = first;
+        assert(first.use_count() == 2);
+        WeakPtr<Snapshot, single_threaded> observer(first);
+        LocalSharedPtr<Snapshot> locked = observer.lock();
+        assert(locked.get() == first.get());
+        locked.reset();
+        second.reset();
+        first.reset();
+        assert(observer.expired());
+        assert(Snapshot::alive == 0);
+
+        LocalSharedPtr<Base> base = LocalSharedPtr<Derived>(new Derived());
+        assert(dynamic_cast<Derived*>(base.get()) != nullptr);
+        std::allocator<int> allocator;
+        assert(*allocateLocalShared<int>(allocator, 7) == 7);
+    }
+
+    // conversions only take sole owners
+    {
+        LocalSharedPtr<int> local = makeLocalShared<int>(1);
+        LocalSharedPtr<int> copy = local;
+        SharedPtr<int> shared = toShared(std::move(local));
+        assert(shared.get() == nullptr);
+        assert(*local == 1);
+        copy.reset();
+
+        {
+            WeakPtr<int, single_threaded> observer(local);
+            assert(toShared(std::move(local)).get() == nullptr);
+        }
+
+        int* object = local.get();
+        shared = toShared(std::move(local));
+        assert(shared.get() == object);
+        assert(local.get() == nullptr);
+        assert(shared.use_count() == 1);
+
+        // the block now counts atomically
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([shared]() {
+                for (int i = 0; i < 1000; ++i) {
+                    SharedPtr<int> copy = shared;
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        assert(shared.use_count() == 1);
+
+        SharedPtr<int> other = shared;
+        assert(toLocalShared(std::move(shared)).get() == nullptr);
+        other.reset();
+        local = toLocalShared(std::move(shared));
+        assert(local.get() == object);
+        assert(shared.get() == nullptr);
+        assert(local.use_count() == 1);
+
+        local.resetInPlace(2);
+        assert(local.get() == object);
+        assert(*local == 2);
+    }
+    assert(Snapshot::alive == 0);
+}
+
 int main() {
     //static_assert(!std::is_base_of_v<std::shared_ptr<VerySpecialType>, SharedPtr<VerySpecialType>>,
     //        "don't try to use std smart pointers");
@@ -637,6 +1972,66 @@ int main() {
     test_custom_deleter();
     std::cerr << "Test 5 (custom deleter) passed." << std::endl;
 
+    test_threading_policies();
+    std::cerr << "Test 6 (threading policies) passed." << std::endl;
+
+    test_atomic_shared_ptr();
+    std::cerr << "Test 7 (atomic shared ptr) passed." << std::endl;
+
+    test_block_size();
+    std::cerr << "Test 8 (block size) passed." << std::endl;
+
+    test_pool_allocator();
+    std::cerr << "Test 9 (pool allocator) passed." << std::endl;
+
+    test_deferred_release();
+    std::cerr << "Test 10 (deferred release) passed." << std::endl;
+
+    test_background_release();
+    std::cerr << "Test 11 (background release) passed." << std::endl;
+
+    test_pointer_casts();
+    std::cerr << "Test 12 (pointer casts) passed." << std::endl;
+
+    test_biased_counting();
+    std::cerr << "Test 13 (biased counting) passed." << std::endl;
+
+    test_refcount_buffer();
+    std::cerr << "Test 14 (refcount buffer) passed." << std::endl;
+
+    test_intrusive_ptr();
+    std::cerr << "Test 15 (intrusive ptr) passed." << std::endl;
+
+    test_compact_shared_ptr();
+    std::cerr << "Test 16 (compact shared ptr) passed." << std::endl;
+
+    test_arrays();
+    std::cerr << "Test 17 (arrays) passed." << std::endl;
+
+    test_for_overwrite();
+    std::cerr << "Test 18 (for overwrite) passed." << std::endl;
+
+    test_out_of_line();
+    std::cerr << "Test 19 (out of line objects) passed." << std::endl;
+
+    test_block_reuse();
+    std::cerr << "Test 20 (block reuse) passed." << std::endl;
+
+    test_hazard_pointers();
+    std::cerr << "Test 21 (hazard pointers) passed." << std::endl;
+
+    test_epoch_reclamation();
+    std::cerr << "Test 22 (epoch reclamation) passed." << std::endl;
+
+    test_rcu_ptr();
+    std::cerr << "Test 23 (rcu ptr) passed." << std::endl;
+
+    test_cycle_collector();
+    std::cerr << "Test 24 (cycle collector) passed." << std::endl;
+
+    test_local_shared_ptr();
+    std::cerr << "Test 25 (local shared ptr) passed." << std::endl;
+
     std::cout << 0;
 }
 